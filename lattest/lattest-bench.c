@@ -0,0 +1,848 @@
+/**
+ * Benchmark sweep and report tool for LatTest
+ *
+ * Runs the measurement for every combination of the given periods, CPU
+ * sets, timer modes and load types via the sysfs interface of the module,
+ * waits for each run to finish and writes one line per run with the results
+ * of statistics_bin to a CSV or JSON file. Two CSV result files can be
+ * compared to find latency regressions, e.g., between two kernel builds.
+ * It also collects the window summaries streamed via generic netlink.
+ *
+ * Usage
+ *   lattest-bench run [options] result.csv
+ *     -d dir ...... sysfs directory of the instance, default /sys/class/LatTest/LatTest
+ *     -p ns ....... period in ns
+ *     -c cpus ..... list of CPUs to run a timer on, e.g. "0-3"
+ *     -m mode ..... timer mode, e.g. "rel pinned hard"
+ *     -l load ..... background load type, e.g. "cache"
+ *     -L cpus ..... list of CPUs to run a load thread on, once for all runs
+ *     -n num ...... number of periods of each run, default 100000
+ *     -j .......... write JSON instead of CSV
+ *   -p, -c, -m and -l can be given several times for a sweep, without them
+ *   the current setting of the instance is used.
+ *
+ *   lattest-bench diff [-t percent] [-a ns] old.csv new.csv
+ *     compares the runs with the same period, CPUs, timer mode and load and
+ *     reports those whose mean, max, p99 or p99.99 latency grew by more than
+ *     percent (default 10) and by more than ns (default 1000). The exit
+ *     status is 1 if there is any.
+ *
+ *   lattest-bench stream [-d dir] [-e] [-n num]
+ *     writes one CSV line per streamed window of all instances to stdout,
+ *     e.g., to forward them off-board with "| nc host port". -e writes 1 to
+ *     the stream attribute of the instance first and 0 again at the end.
+ *     It ends after num windows or on SIGINT or SIGTERM.
+ *
+ * Build with "make bench".
+ *
+ * Author: Johann Glaser
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "lattest.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Configuration /////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+#define DEFAULT_DIR      "/sys/class/LatTest/LatTest"
+#define DEFAULT_RUNCOUNT 100000
+#define SWEEP_MAX        32        // maximum number of values per swept setting
+#define VALUE_LEN        64        // maximum length of a setting
+#define POLL_MS          100       // interval to read status for the end of a run, without the event attribute
+#define RESULT_MAX       4096      // maximum number of runs in a result file
+#define NETLINK_BUF      65536     // receive buffer for one netlink message
+#define STREAM_INSTANCES 16        // instances whose lost windows are tracked
+
+//////////////////////////////////////////////////////////////////////////////
+// Types /////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// values of one swept setting, an empty list keeps the current one
+struct sweep {
+  const char *attr;                 // name of the sysfs attribute
+  const char *value[SWEEP_MAX];
+  int num;
+};
+
+// settings and results of one run, i.e., one line of a result file
+struct result {
+  char period_ns[VALUE_LEN];
+  char cpus[VALUE_LEN];
+  char timer_mode[VALUE_LEN];
+  char load[VALUE_LEN];
+  long long runcount;
+  long long num;
+  long long min;
+  double mean;
+  long long max;
+  double stddev;
+  long long p50;
+  long long p99;
+  long long p999;
+  long long p9999;
+  long long jitter_min;
+  long long jitter_max;
+  double jitter_stddev;
+  long long overruns;
+  double overhead_mean;
+  long long overhead_max;
+  long long thread_max;
+  long long irq_max;
+};
+
+static const char *csv_header =
+  "period_ns,cpus,timer_mode,load,runcount,num,min,mean,max,stddev,p50,p99,p999,p9999,"
+  "jitter_min,jitter_max,jitter_stddev,overruns,overhead_mean,overhead_max,thread_max,irq_max";
+
+//////////////////////////////////////////////////////////////////////////////
+// SysFS /////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+static const char *sysfs_dir = DEFAULT_DIR;
+
+/**
+ * Write a value to an attribute of the instance
+ */
+static int attr_write(const char *attr, const char *value) {
+  char path[256];
+  int fd;
+  ssize_t len;
+
+  snprintf(path, sizeof(path), "%s/%s", sysfs_dir, attr);
+  fd = open(path, O_WRONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  len = write(fd, value, strlen(value));
+  if (len < 0) {
+    fprintf(stderr, "Can't write \"%s\" to %s: %s\n", value, path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+/**
+ * Read an attribute of the instance into buf, without the trailing newline
+ */
+static int attr_read(const char *attr, char *buf, size_t size) {
+  char path[256];
+  int fd;
+  ssize_t len;
+
+  snprintf(path, sizeof(path), "%s/%s", sysfs_dir, attr);
+  buf[0] = '\0';
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  len = read(fd, buf, size-1);
+  close(fd);
+  if (len < 0) return -1;
+  buf[len] = '\0';
+  while (len > 0 && buf[len-1] == '\n') buf[--len] = '\0';
+  return 0;
+}
+
+/**
+ * Read a whole binary attribute, the returned buffer has to be freed
+ */
+static void *attr_read_bin(const char *attr, size_t *size) {
+  char path[256];
+  char *buf = NULL;
+  size_t alloc = 0;
+  size_t pos = 0;
+  ssize_t len;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/%s", sysfs_dir, attr);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  do {
+    if (pos == alloc) {
+      char *tmp;
+      alloc = alloc ? 2*alloc : 65536;
+      tmp = realloc(buf, alloc);
+      if (!tmp) {
+        free(buf);
+        close(fd);
+        return NULL;
+      }
+      buf = tmp;
+    }
+    len = read(fd, buf + pos, alloc - pos);
+    if (len > 0) pos += len;
+  } while (len > 0);
+  close(fd);
+  if (len < 0) {
+    fprintf(stderr, "Can't read %s: %s\n", path, strerror(errno));
+    free(buf);
+    return NULL;
+  }
+  *size = pos;
+  return buf;
+}
+
+/**
+ * Sleep for ms milliseconds
+ */
+static void sleep_ms(long ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+/**
+ * Current time of CLOCK_MONOTONIC in ms
+ */
+static long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Wait until the timers of the instance have stopped
+ *
+ * Sleeps in poll() on the event attribute, which is notified at the end of
+ * a run, so the board isn't disturbed by reading status all the time. Older
+ * modules without it are polled every POLL_MS.
+ */
+static int wait_stopped(long long timeout_ms) {
+  char path[256];
+  char status[4096];
+  char event[64];
+  long long end = now_ms() + timeout_ms;
+  long long left;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/event", sysfs_dir);
+  fd = open(path, O_RDONLY);
+  for (;;) {
+    // reading event arms the next notification, before status is checked
+    if (fd >= 0 && (lseek(fd, 0, SEEK_SET) < 0 || read(fd, event, sizeof(event)) < 0)) {
+      close(fd);
+      fd = -1;
+    }
+    if (attr_read("status", status, sizeof(status)) < 0) {
+      fprintf(stderr, "Can't read %s/status\n", sysfs_dir);
+      break;
+    }
+    if (strstr(status, "Status: stopped")) {
+      if (fd >= 0) close(fd);
+      return 0;
+    }
+    left = end - now_ms();
+    if (left <= 0) {
+      fprintf(stderr, "Run didn't finish within %lld ms, stopping it\n", timeout_ms);
+      attr_write("control", "stop");
+      break;
+    }
+    if (fd >= 0) {
+      struct pollfd pfd = { fd, POLLPRI | POLLERR, 0 };
+      poll(&pfd, 1, (left < 60000) ? (int)left : 60000);
+    } else {
+      sleep_ms(POLL_MS);
+    }
+  }
+  if (fd >= 0) close(fd);
+  return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Run ///////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Standard deviation from the sums of a statistics block
+ */
+static double snap_stddev(const struct lattest_snapshot_stat *st) {
+  long double sumsq;
+  long double mean;
+  long double var;
+
+  if (st->num < 2) return 0.0;
+  sumsq = ldexpl((long double)st->sumsq_hi, 64) + (long double)st->sumsq_lo;
+  mean  = (long double)st->sum / st->num;
+  var   = sumsq / st->num - mean*mean;
+  return (var > 0) ? sqrt((double)var) : 0.0;
+}
+
+/**
+ * Mean of a statistics block
+ */
+static double snap_mean(const struct lattest_snapshot_stat *st) {
+  return (st->num > 0) ? (double)st->sum / st->num : 0.0;
+}
+
+/**
+ * Fill the results of a run from the binary statistics snapshot
+ */
+static int result_fill(struct result *r) {
+  struct lattest_snapshot *snap;
+  size_t size;
+
+  snap = attr_read_bin("statistics_bin", &size);
+  if (!snap) return -1;
+  if (size < sizeof(*snap) - sizeof(snap->overhead) || snap->version < 5) {
+    fprintf(stderr, "Unsupported statistics_bin version %u, size %zu\n", snap->version, size);
+    free(snap);
+    return -1;
+  }
+  r->num           = snap->latency.num;
+  r->min           = snap->latency.min;
+  r->mean          = snap_mean(&snap->latency);
+  r->max           = snap->latency.max;
+  r->stddev        = snap_stddev(&snap->latency);
+  r->p50           = snap->latency.percentile[0];
+  r->p99           = snap->latency.percentile[1];
+  r->p999          = snap->latency.percentile[2];
+  r->p9999         = snap->latency.percentile[3];
+  r->jitter_min    = snap->jitter.min;
+  r->jitter_max    = snap->jitter.max;
+  r->jitter_stddev = snap_stddev(&snap->jitter);
+  r->overruns      = snap->overruns;
+  // not there before version 6
+  r->overhead_mean = (snap->version >= 6) ? snap_mean(&snap->overhead) : 0.0;
+  r->overhead_max  = (snap->version >= 6 && snap->overhead.num > 0) ? snap->overhead.max : 0;
+  r->thread_max    = (snap->thread.num > 0) ? snap->thread.max : 0;
+  r->irq_max       = (snap->irq.num > 0) ? snap->irq.max : 0;
+  free(snap);
+  return 0;
+}
+
+/**
+ * Print a string as a quoted CSV or JSON field
+ */
+static void print_quoted(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"') fputc(*s, f);   // "" as in CSV, the values of JSON files never contain quotes
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+/**
+ * Write the results of a run as CSV line
+ */
+static void result_print_csv(FILE *f, const struct result *r) {
+  print_quoted(f, r->period_ns);  fputc(',', f);
+  print_quoted(f, r->cpus);       fputc(',', f);
+  print_quoted(f, r->timer_mode); fputc(',', f);
+  print_quoted(f, r->load);
+  fprintf(f, ",%lld,%lld,%lld,%.1f,%lld,%.1f,%lld,%lld,%lld,%lld,%lld,%lld,%.1f,%lld,%.1f,%lld,%lld,%lld\n",
+    r->runcount, r->num, r->min, r->mean, r->max, r->stddev, r->p50, r->p99, r->p999, r->p9999,
+    r->jitter_min, r->jitter_max, r->jitter_stddev, r->overruns, r->overhead_mean, r->overhead_max,
+    r->thread_max, r->irq_max);
+}
+
+/**
+ * Write the results of a run as JSON object
+ */
+static void result_print_json(FILE *f, const struct result *r, int first) {
+  fprintf(f, "%s\n  {", first ? "" : ",");
+  fprintf(f, "\"period_ns\": ");   print_quoted(f, r->period_ns);
+  fprintf(f, ", \"cpus\": ");      print_quoted(f, r->cpus);
+  fprintf(f, ", \"timer_mode\": "); print_quoted(f, r->timer_mode);
+  fprintf(f, ", \"load\": ");      print_quoted(f, r->load);
+  fprintf(f, ", \"runcount\": %lld, \"num\": %lld, \"min\": %lld, \"mean\": %.1f, \"max\": %lld, \"stddev\": %.1f"
+    ", \"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"p9999\": %lld"
+    ", \"jitter_min\": %lld, \"jitter_max\": %lld, \"jitter_stddev\": %.1f, \"overruns\": %lld"
+    ", \"overhead_mean\": %.1f, \"overhead_max\": %lld, \"thread_max\": %lld, \"irq_max\": %lld}",
+    r->runcount, r->num, r->min, r->mean, r->max, r->stddev, r->p50, r->p99, r->p999, r->p9999,
+    r->jitter_min, r->jitter_max, r->jitter_stddev, r->overruns, r->overhead_mean, r->overhead_max,
+    r->thread_max, r->irq_max);
+}
+
+/**
+ * Apply the settings of one run, start it, wait for its end and fetch the
+ * results
+ */
+static int run_one(struct result *r, long long runcount) {
+  char buf[VALUE_LEN];
+  long long period_ns;
+  long long timeout_ms;
+
+  if (r->period_ns[0]  && attr_write("period_ns",  r->period_ns)  < 0) return -1;
+  if (r->cpus[0]       && attr_write("cpus",       r->cpus)       < 0) return -1;
+  if (r->timer_mode[0] && attr_write("timer_mode", r->timer_mode) < 0) return -1;
+  if (r->load[0]       && attr_write("load",       r->load)       < 0) return -1;
+  // record the settings actually used
+  if (attr_read("period_ns", r->period_ns, sizeof(r->period_ns)) < 0) return -1;
+  attr_read("cpus",       r->cpus,       sizeof(r->cpus));
+  attr_read("timer_mode", r->timer_mode, sizeof(r->timer_mode));
+  if (attr_read("load", r->load, sizeof(r->load)) < 0) strcpy(r->load, "none");   // only the first instance has a load
+  r->runcount = runcount;
+  period_ns = atoll(r->period_ns);
+  if (period_ns <= 0) {
+    fprintf(stderr, "Invalid period_ns '%s'\n", r->period_ns);
+    return -1;
+  }
+
+  fprintf(stderr, "Running %lld periods of %s ns on CPUs %s, %s, load %s\n",
+    runcount, r->period_ns, r->cpus, r->timer_mode, r->load);
+  snprintf(buf, sizeof(buf), "%lld", runcount);
+  if (attr_write("control", buf) < 0) return -1;
+  // twice the nominal duration, overruns make it take longer
+  timeout_ms = 2 * (runcount * period_ns / 1000000) + 5000;
+  if (wait_stopped(timeout_ms) < 0) return -1;
+  return result_fill(r);
+}
+
+/**
+ * Run all combinations of the sweeps and write the results
+ */
+static int cmd_run(int argc, char *argv[]) {
+  struct sweep period = { .attr = "period_ns" };
+  struct sweep cpus   = { .attr = "cpus" };
+  struct sweep mode   = { .attr = "timer_mode" };
+  struct sweep load   = { .attr = "load" };
+  struct sweep *sw;
+  const char *load_cpus = NULL;
+  long long runcount = DEFAULT_RUNCOUNT;
+  int json = 0;
+  int first = 1;
+  int failed = 0;
+  int ip, ic, im, il;
+  FILE *f;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:p:c:m:l:L:n:j")) != -1) {
+    sw = NULL;
+    switch (opt) {
+      case 'd': sysfs_dir = optarg; break;
+      case 'p': sw = &period; break;
+      case 'c': sw = &cpus;   break;
+      case 'm': sw = &mode;   break;
+      case 'l': sw = &load;   break;
+      case 'L': load_cpus = optarg; break;
+      case 'n': runcount = atoll(optarg); break;
+      case 'j': json = 1; break;
+      default: return 2;
+    }
+    if (sw) {
+      if (sw->num >= SWEEP_MAX || strlen(optarg) >= VALUE_LEN) {
+        fprintf(stderr, "Too many or too long values for %s\n", sw->attr);
+        return 2;
+      }
+      sw->value[sw->num++] = optarg;
+    }
+  }
+  if (optind != argc-1 || runcount <= 0) {
+    fprintf(stderr, "Usage: lattest-bench run [-d dir] [-p ns]... [-c cpus]... [-m mode]... [-l load]... [-L cpus] [-n num] [-j] result\n");
+    return 2;
+  }
+  // an empty list keeps the current setting
+  if (period.num == 0) period.value[period.num++] = "";
+  if (cpus.num   == 0) cpus.value[cpus.num++]     = "";
+  if (mode.num   == 0) mode.value[mode.num++]     = "";
+  if (load.num   == 0) load.value[load.num++]     = "";
+  if (load_cpus && attr_write("load_cpus", load_cpus) < 0) return 1;
+
+  f = fopen(argv[optind], "w");
+  if (!f) {
+    fprintf(stderr, "Can't create %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+  if (json) fprintf(f, "[");
+  else      fprintf(f, "%s\n", csv_header);
+  for (ip = 0; ip < period.num; ip++) {
+    for (ic = 0; ic < cpus.num; ic++) {
+      for (im = 0; im < mode.num; im++) {
+        for (il = 0; il < load.num; il++) {
+          struct result r;
+          memset(&r, 0, sizeof(r));
+          strcpy(r.period_ns,  period.value[ip]);
+          strcpy(r.cpus,       cpus.value[ic]);
+          strcpy(r.timer_mode, mode.value[im]);
+          strcpy(r.load,       load.value[il]);
+          if (run_one(&r, runcount) < 0) {
+            failed++;
+            continue;
+          }
+          if (json) result_print_json(f, &r, first);
+          else      result_print_csv(f, &r);
+          first = 0;
+          fflush(f);
+        }
+      }
+    }
+  }
+  if (json) fprintf(f, "\n]\n");
+  fclose(f);
+  if (load.value[0][0]) attr_write("load", "none");
+  if (failed) fprintf(stderr, "%d runs failed\n", failed);
+  return failed ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Diff //////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Parse the next CSV field at *s into buf, advances *s behind the comma
+ */
+static void csv_field(char **s, char *buf, size_t size) {
+  char *p = *s;
+  size_t len = 0;
+
+  if (*p == '"') {
+    p++;
+    while (*p && !(*p == '"' && p[1] != '"')) {
+      if (*p == '"') p++;   // "" is an escaped quote
+      if (len < size-1) buf[len++] = *p;
+      p++;
+    }
+    if (*p == '"') p++;
+  } else {
+    while (*p && *p != ',' && *p != '\n') {
+      if (len < size-1) buf[len++] = *p;
+      p++;
+    }
+  }
+  buf[len] = '\0';
+  if (*p == ',') p++;
+  *s = p;
+}
+
+/**
+ * Read a CSV result file, returns the number of runs or -1
+ */
+static int results_read(const char *name, struct result *res, int max) {
+  char line[1024];
+  char field[VALUE_LEN];
+  int num = 0;
+  FILE *f;
+
+  f = fopen(name, "r");
+  if (!f) {
+    fprintf(stderr, "Can't open %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  if (!fgets(line, sizeof(line), f) || strncmp(line, csv_header, strlen("period_ns,cpus,timer_mode,load")) != 0) {
+    fprintf(stderr, "%s is no CSV result file\n", name);
+    fclose(f);
+    return -1;
+  }
+  while (num < max && fgets(line, sizeof(line), f)) {
+    struct result *r = &res[num];
+    char *s = line;
+    memset(r, 0, sizeof(*r));
+    csv_field(&s, r->period_ns,  sizeof(r->period_ns));
+    csv_field(&s, r->cpus,       sizeof(r->cpus));
+    csv_field(&s, r->timer_mode, sizeof(r->timer_mode));
+    csv_field(&s, r->load,       sizeof(r->load));
+    csv_field(&s, field, sizeof(field)); r->runcount = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->num      = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->min      = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->mean     = atof(field);
+    csv_field(&s, field, sizeof(field)); r->max      = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->stddev   = atof(field);
+    csv_field(&s, field, sizeof(field)); r->p50      = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->p99      = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->p999     = atoll(field);
+    csv_field(&s, field, sizeof(field)); r->p9999    = atoll(field);
+    // the rest isn't compared
+    num++;
+  }
+  fclose(f);
+  return num;
+}
+
+/**
+ * Compare one value of two runs, prints it and returns 1 if it regressed
+ */
+static int diff_value(const char *name, double old_val, double new_val, double percent, double abs_ns) {
+  int regressed = (new_val - old_val > abs_ns) && (new_val > old_val * (1.0 + percent/100.0));
+  printf("  %-6s %10.0f -> %10.0f ns %+7.1f%%%s\n", name, old_val, new_val,
+    (old_val != 0.0) ? (new_val - old_val) * 100.0 / old_val : 0.0, regressed ? "  REGRESSION" : "");
+  return regressed;
+}
+
+/**
+ * Compare two CSV result files
+ */
+static int cmd_diff(int argc, char *argv[]) {
+  static struct result old_res[RESULT_MAX];
+  static struct result new_res[RESULT_MAX];
+  double percent = 10.0;
+  double abs_ns = 1000.0;
+  int old_num;
+  int new_num;
+  int regressions = 0;
+  int i, j;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:a:")) != -1) {
+    switch (opt) {
+      case 't': percent = atof(optarg); break;
+      case 'a': abs_ns  = atof(optarg); break;
+      default: return 2;
+    }
+  }
+  if (optind != argc-2) {
+    fprintf(stderr, "Usage: lattest-bench diff [-t percent] [-a ns] old.csv new.csv\n");
+    return 2;
+  }
+  old_num = results_read(argv[optind],   old_res, RESULT_MAX);
+  new_num = results_read(argv[optind+1], new_res, RESULT_MAX);
+  if (old_num < 0 || new_num < 0) return 2;
+
+  for (i = 0; i < new_num; i++) {
+    const struct result *n = &new_res[i];
+    const struct result *o = NULL;
+    for (j = 0; j < old_num; j++) {
+      if (strcmp(old_res[j].period_ns, n->period_ns) == 0 && strcmp(old_res[j].cpus, n->cpus) == 0 &&
+          strcmp(old_res[j].timer_mode, n->timer_mode) == 0 && strcmp(old_res[j].load, n->load) == 0) {
+        o = &old_res[j];
+        break;
+      }
+    }
+    printf("period %s ns, CPUs %s, %s, load %s:%s\n", n->period_ns, n->cpus, n->timer_mode, n->load, o ? "" : " new");
+    if (!o) continue;
+    regressions += diff_value("mean",   o->mean,  n->mean,  percent, abs_ns);
+    regressions += diff_value("max",    o->max,   n->max,   percent, abs_ns);
+    regressions += diff_value("p99",    o->p99,   n->p99,   percent, abs_ns);
+    regressions += diff_value("p99.99", o->p9999, n->p9999, percent, abs_ns);
+  }
+  printf("%d regressions\n", regressions);
+  return regressions ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Stream ////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+static const char *stream_csv_header =
+  "instance,cpu,start_ns,start_realtime_ns,num,min,mean,max,overruns";
+
+/**
+ * Iterate over the netlink attributes in [data, data+len)
+ */
+#define NLA_FOREACH(nla, data, len) \
+  for (nla = (struct nlattr *)(data); \
+       (char *)nla + NLA_HDRLEN <= (char *)(data) + (len) && nla->nla_len >= NLA_HDRLEN && \
+       (char *)nla + nla->nla_len <= (char *)(data) + (len); \
+       nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len)))
+
+#define NLA_DATA(nla) ((void *)((char *)(nla) + NLA_HDRLEN))
+#define NLA_PAYLOAD(nla) ((int)(nla)->nla_len - NLA_HDRLEN)
+
+/**
+ * Resolve the family id and the multicast group of LatTest via the
+ * generic netlink controller
+ */
+static int genl_resolve(int sock, int *family, unsigned int *group) {
+  static char buf[NETLINK_BUF];
+  struct {
+    struct nlmsghdr n;
+    struct genlmsghdr g;
+    char attr[64];
+  } req;
+  struct nlattr *nla = (struct nlattr *)req.attr;
+  struct nlmsghdr *n;
+  struct nlattr *a;
+  struct nlattr *grp;
+  struct nlattr *ga;
+  ssize_t len;
+
+  memset(&req, 0, sizeof(req));
+  nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+  nla->nla_len  = NLA_HDRLEN + sizeof(LATTEST_GENL_NAME);
+  memcpy(NLA_DATA(nla), LATTEST_GENL_NAME, sizeof(LATTEST_GENL_NAME));
+  req.n.nlmsg_len   = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(nla->nla_len);
+  req.n.nlmsg_type  = GENL_ID_CTRL;
+  req.n.nlmsg_flags = NLM_F_REQUEST;
+  req.g.cmd         = CTRL_CMD_GETFAMILY;
+  req.g.version     = 1;
+  if (send(sock, &req, req.n.nlmsg_len, 0) < 0) return -1;
+  len = recv(sock, buf, sizeof(buf), 0);
+  if (len < 0) return -1;
+
+  *family = -1;
+  *group  = 0;
+  for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+    if (n->nlmsg_type == NLMSG_ERROR) return -1;   // family not registered, module not loaded
+    if (n->nlmsg_type != GENL_ID_CTRL) continue;
+    NLA_FOREACH(a, (char *)NLMSG_DATA(n) + GENL_HDRLEN, n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)) {
+      if (a->nla_type == CTRL_ATTR_FAMILY_ID) *family = *(__u16 *)NLA_DATA(a);
+      if (a->nla_type != CTRL_ATTR_MCAST_GROUPS) continue;
+      NLA_FOREACH(grp, NLA_DATA(a), NLA_PAYLOAD(a)) {
+        const char *name = NULL;
+        unsigned int id = 0;
+        NLA_FOREACH(ga, NLA_DATA(grp), NLA_PAYLOAD(grp)) {
+          if (ga->nla_type == CTRL_ATTR_MCAST_GRP_NAME) name = NLA_DATA(ga);
+          if (ga->nla_type == CTRL_ATTR_MCAST_GRP_ID)   id   = *(__u32 *)NLA_DATA(ga);
+        }
+        if (name && strcmp(name, LATTEST_GENL_MCGRP) == 0) *group = id;
+      }
+    }
+  }
+  return (*family >= 0 && *group != 0) ? 0 : -1;
+}
+
+static volatile sig_atomic_t stream_stop;
+
+static void stream_signal(int sig) {
+  (void)sig;
+  stream_stop = 1;
+}
+
+/**
+ * Print the windows of one LATTEST_CMD_WINDOWS message, at most max of them
+ *
+ * Returns the number of windows printed.
+ */
+static long long stream_print(const struct nlmsghdr *n, long long max) {
+  const char *data = (const char *)NLMSG_DATA(n) + GENL_HDRLEN;
+  int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+  static unsigned int lost_last[STREAM_INSTANCES];
+  unsigned int instance = 0;
+  long long realtime_offset = 0;
+  long long count = 0;
+  struct nlattr *a;
+
+  // the header attributes come before the windows
+  NLA_FOREACH(a, data, len) {
+    switch (a->nla_type) {
+      case LATTEST_NLA_INSTANCE:        instance = *(__u32 *)NLA_DATA(a); break;
+      case LATTEST_NLA_REALTIME_OFFSET: memcpy(&realtime_offset, NLA_DATA(a), sizeof(realtime_offset)); break;
+      case LATTEST_NLA_WINDOW: {
+        struct lattest_window w;
+        if (NLA_PAYLOAD(a) < (int)sizeof(w) || count >= max) break;
+        memcpy(&w, NLA_DATA(a), sizeof(w));
+        printf("%u,%u,%lld,%lld,%lld,%lld,%.1f,%lld,%lld\n", instance, w.cpu, (long long)w.start_ns,
+          (long long)(w.start_ns + realtime_offset), (long long)w.num, (long long)w.min,
+          w.num ? (double)w.sum / w.num : 0.0, (long long)w.max, (long long)w.overruns);
+        count++;
+        break;
+      }
+      case LATTEST_NLA_LOST: {
+        unsigned int lost = *(__u32 *)NLA_DATA(a);
+        if (instance < STREAM_INSTANCES && lost != lost_last[instance]) {
+          fprintf(stderr, "Instance %u: %u windows lost\n", instance, lost);
+          lost_last[instance] = lost;
+        }
+        break;
+      }
+    }
+  }
+  fflush(stdout);
+  return count;
+}
+
+/**
+ * Print the streamed windows until the given number is reached or interrupted
+ *
+ * SIGINT and SIGTERM are installed without SA_RESTART so that they interrupt
+ * the blocking recv().
+ */
+static int cmd_stream(int argc, char *argv[]) {
+  static char buf[NETLINK_BUF];
+  struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+  struct sigaction sa = { .sa_handler = stream_signal };
+  struct nlmsghdr *n;
+  unsigned int group;
+  long long remaining = -1;   // unlimited
+  int family;
+  int enable = 0;
+  int ret = 0;
+  int sock;
+  ssize_t len;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:en:")) != -1) {
+    switch (opt) {
+      case 'd': sysfs_dir = optarg; break;
+      case 'e': enable = 1; break;
+      case 'n': remaining = atoll(optarg); break;
+      default: return 2;
+    }
+  }
+  if (optind != argc || remaining == 0 || remaining < -1) {
+    fprintf(stderr, "Usage: lattest-bench stream [-d dir] [-e] [-n num]\n");
+    return 2;
+  }
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT,  &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+  if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "Can't open netlink socket: %s\n", strerror(errno));
+    return 1;
+  }
+  if (genl_resolve(sock, &family, &group) < 0) {
+    fprintf(stderr, "Can't find generic netlink family %s, is the module loaded?\n", LATTEST_GENL_NAME);
+    close(sock);
+    return 1;
+  }
+  if (setsockopt(sock, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+    fprintf(stderr, "Can't join multicast group %s: %s\n", LATTEST_GENL_MCGRP, strerror(errno));
+    close(sock);
+    return 1;
+  }
+  if (enable && attr_write("stream", "1") < 0) {
+    close(sock);
+    return 1;
+  }
+
+  printf("%s\n", stream_csv_header);
+  fflush(stdout);
+  while (!stream_stop && remaining != 0) {
+    len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;   // stream_stop is checked by the loop
+      if (errno == ENOBUFS) {
+        // the socket overflowed, messages were dropped
+        fprintf(stderr, "Netlink receive buffer overflow\n");
+        continue;
+      }
+      fprintf(stderr, "Can't receive: %s\n", strerror(errno));
+      ret = 1;
+      break;
+    }
+    for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+      if (n->nlmsg_type == family && n->nlmsg_len >= NLMSG_LENGTH(GENL_HDRLEN) &&
+          ((struct genlmsghdr *)NLMSG_DATA(n))->cmd == LATTEST_CMD_WINDOWS) {
+        long long printed = stream_print(n, remaining < 0 ? LLONG_MAX : remaining);
+        if (remaining > 0) remaining -= printed;
+        if (remaining == 0) break;
+      }
+    }
+  }
+  fflush(stdout);
+  if (enable && attr_write("stream", "0") < 0) ret = 1;
+  close(sock);
+  return ret;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Main //////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+  if (argc >= 2 && strcmp(argv[1], "run") == 0)  return cmd_run(argc-1, argv+1);
+  if (argc >= 2 && strcmp(argv[1], "diff") == 0) return cmd_diff(argc-1, argv+1);
+  if (argc >= 2 && strcmp(argv[1], "stream") == 0) return cmd_stream(argc-1, argv+1);
+  fprintf(stderr, "Usage: lattest-bench run [options] result | diff [options] old.csv new.csv | stream [options]\n");
+  return 2;
+}
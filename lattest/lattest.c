@@ -5,9 +5,52 @@
  *
  * Features:
  *  - periodically executed function using hrtimer
- *  - statistics for variation of the latency
- *  - toggling GPIO
- *  - sysfs interface
+ *  - one pinned hrtimer per selected CPU, with per-CPU statistics
+ *  - statistics for variation of the latency (jitter between consecutive
+ *    callbacks) and of the wakeup latency against the programmed expiry
+ *  - linear or log-linear (HdrHistogram-like) histograms
+ *  - percentiles computed from the histograms
+ *  - rolling window summaries of the latency, to locate spikes in long runs
+ *  - accounting of overruns, i.e., expiries missed because a callback was
+ *    delayed by more than a period
+ *  - absolute ("abs", on a fixed grid like hrtimer_forward()) or relative
+ *    ("rel") expiries: with "rel" the next expiry is a period after each
+ *    callback instead of the next grid point, so latencies accumulate like
+ *    with nanosleep() in a loop, the jitter is the callback distance minus
+ *    the period and every full period of latency counts as an overrun
+ *  - statistics of the execution time of the timer callback itself, i.e.,
+ *    the overhead of the measurement
+ *  - toggling GPIO, optionally by writing the BCM2835/BCM2711 GPSET/GPCLR
+ *    registers directly instead of using gpiolib
+ *  - optional GPIO loopback: the toggled output wired to an input, whose
+ *    interrupt records the edge-to-IRQ latency
+ *  - outlier log of the samples above a latency threshold, optionally
+ *    stopping ftrace at the first one to keep the trace leading up to it,
+ *    with the interrupts, softirqs and the interrupted task on that CPU
+ *    since the previous callback, and its busiest device IRQs
+ *  - optional background load threads (cache thrashing, memory bandwidth,
+ *    self-IPI storm, spinlock contention), started and stopped with the timers
+ *  - sysfs interface, with poll() notifications at the end of a run and
+ *    at outliers
+ *  - streaming of the rolling window summaries via generic netlink, e.g.,
+ *    to forward them off-board
+ *  - tracepoints for the samples, overruns and the start and end of runs,
+ *    for perf, trace-cmd and eBPF, see lattest_trace.h
+ *  - complete histograms of all CPUs as CSV in debugfs, of any size
+ *  - optional per-CPU ring buffers of raw samples, mmap()able via /dev/LatTest
+ *  - optional per-CPU SCHED_FIFO threads woken by the timer, with a separate
+ *    statistics of the thread wakeup latency (like cyclictest)
+ *  - optional cross-CPU IPIs sent by each timer to the other CPUs in turn,
+ *    with statistics of the IPI delivery latency per pair of CPUs
+ *  - idle state the CPU woke up from and its frequency for each sample,
+ *    latency statistics per idle state, and an optional PM QoS request to
+ *    keep the CPUs out of deep idle states during a run
+ *  - multiple independent test instances, e.g., to compare timer modes or
+ *    CPU sets at the same time
+ *  - optional timestamps from the ARM generic timer counter instead of
+ *    ktime, for a finer resolution and less overhead per sample
+ *  - configuration and start at load time by module parameters, also when
+ *    built in, to measure the latency during boot
  *
  * Control interface via SysFS
  *  - query current status: inactive/running, period, resolution, ...
@@ -15,14 +58,61 @@
  *  - set number of periods or infinite
  *  - start / stop
  *  - query statistics
- *  - configure statistics: number and width of histogram bins
+ *  - configure statistics: number, width and offset of histogram bins
  *
  * /sys/class/LatTest/LatTest/
  *   .../status ...... (r) query current status: inactive/running, period, resolution, ...
+ *   .../event ....... (r) number and type of the last notification, poll() for POLLPRI: "done", "outlier"
  *   .../period ...... (rw) set/get period in ms
- *   .../control ..... (w) start (with number of periods) / stop
- *   .../config ...... (rw) configure statistics: number and width of histogram bins
- *   .../statistics .. (r) statistics: min, max, mean, stddev, histogram
+ *   .../period_ns ... (rw) set/get period in ns
+ *   .../control ..... (w) start (with number of periods) / stop / reset statistics
+ *   .../config ...... (rw) configure statistics: number, width and offset of histogram bins
+ *   .../hist_mode ... (rw) set/get histogram mode: "linear" or "log"
+ *   .../cpus ........ (rw) set/get list of CPUs to run a timer on, e.g. "0-3" or "2,3"
+ *   .../timer_mode .. (rw) set/get hrtimer mode: "abs"/"rel", "pinned", "hard"/"soft"/"default"
+ *   .../clock ....... (rw) set/get hrtimer clock: "monotonic", "tai" or "boottime"
+ *   .../timestamp ... (rw) set/get timestamp source: "ktime" or "counter" (ARM generic timer)
+ *   .../thread_prio . (rw) set/get SCHED_FIFO priority of the wakeup threads, 0 to disable them
+ *   .../ipi ......... (rw) set/get whether each timer sends an IPI to the next other CPU of cpus
+ *   .../idle_qos_us . (rw) set/get CPU latency limit in us requested via PM QoS during a run, -1 to disable
+ *   .../load ........ (rw) set/get background load: "none", "cache", "membw", "ipi" or "spinlock"
+ *   .../threshold_ns  (rw) set/get latency threshold of the outlier log in ns, 0 to disable
+ *   .../breaktrace .. (rw) set/get whether the first outlier calls tracing_off()
+ *   .../outliers .... (r) outlier log: timestamp, CPU, source, latency, IRQs, softirqs and task of the last outliers
+ *   .../window_ms ... (rw) set/get length of the rolling windows in ms, 0 to disable
+ *   .../windows ..... (r) newest rolling window summaries: num, min, max, sum, overruns
+ *   .../windows_bin . (r) all rolling window summaries, see lattest.h for the layout
+ *   .../stream ...... (rw) set/get whether the finished windows are multicast via generic netlink, see lattest.h
+ *   .../load_cpus ... (rw) set/get list of CPUs to run a load thread on
+ *   .../statistics .. (r) statistics: min, max, mean, stddev, histogram of jitter, latency and callback overhead,
+ *                         latency per idle state
+ *   .../ringbuffer .. (rw) set/get number of raw samples per CPU ring buffer, 0 to disable
+ *   .../statistics_bin (r) binary statistics snapshot, see lattest.h for the layout
+ *   .../statistics_last (r) statistics of the interval before the last "reset"
+ *   .../statistics_last_bin (r) binary statistics snapshot of that interval
+ * /sys/kernel/debug/lattest/LatTest/
+ *   .../histogram ... (r) all bins of all histograms, merged and per CPU, as CSV: block,cpu,bin_low_ns,count
+ *                         cpu is "all" for merged ones and "src>dst" for the pairs of the IPIs
+ *   .../sparse ...... (rw) set/get whether histogram only has the non-empty bins
+ * Further instances are /sys/class/LatTest/LatTest1/, ... with /dev/LatTest1,
+ * ..., each with its own configuration and statistics. The GPIO, the GPIO
+ * loopback and the load belong to the first instance, load and load_cpus only
+ * exist there.
+ * Module parameters
+ *   gpio=n ........... GPIO to toggle, -1 to disable, default GPIO_LATTEST_TOGGLE
+ *   gpio_direct=1 .... toggle the GPIO by direct register writes
+ *   gpio_phys=addr ... physical address of the GPIO registers, default from device tree
+ *   gpio_irq=n ....... GPIO input wired to the toggled GPIO for the loopback IRQ latency, -1 (default) to disable
+ *   instances=n ...... number of test instances, 1 (default) .. LATTEST_INSTANCES_MAX
+ *   period_ns=n ...... period of the first instance, like .../period_ns
+ *   cpus=list ........ CPUs of the first instance, like .../cpus
+ *   timer_mode=m,m ... hrtimer mode of the first instance, like .../timer_mode
+ *   hist_mode=m ...... histogram mode of the first instance, like .../hist_mode
+ *   config=n,w[,o] ... histogram bins of the first instance, like .../config
+ *   autostart=n ...... start the first instance at load time with n periods or "infinite"
+ * When built in, the parameters are given on the kernel command line, e.g.
+ * "lattest.autostart=infinite", to capture the latency during boot.
+ *
  * The use of beautified output or of parsed input is strongly discouraged
  * according to https://www.kernel.org/doc/Documentation/filesystems/sysfs.txt.
  * However, we do it. :-)
@@ -32,6 +122,35 @@
  * History
  *  2017-02-08 Created: hrtimer, histogram
  *  2017-02-11 Added GPIO, SysFS
+ *  2026-10-14 Per-CPU timers and statistics
+ *  2026-10-14 Wakeup latency against absolute expiry time
+ *  2026-10-14 Periods with ns resolution
+ *  2026-10-14 Raw sample ring buffers, see lattest.h for the layout
+ *  2026-10-14 Log-linear histograms
+ *  2026-10-14 Overflow-safe 128 bit sum of squares
+ *  2026-10-14 Runtime histogram configuration
+ *  2026-10-14 Binary statistics snapshot
+ *  2026-10-14 Consistent statistics with seqcount, reset while running
+ *  2026-10-14 GPIO configurable at load time, direct register access
+ *  2026-10-14 Selectable hrtimer mode and clock
+ *  2026-10-14 SCHED_FIFO wakeup threads
+ *  2026-10-14 GPIO loopback IRQ latency
+ *  2026-10-14 Background load generators
+ *  2026-10-14 Overrun accounting
+ *  2026-10-14 Outlier log, tracing_off() at the first outlier
+ *  2026-10-14 Percentiles
+ *  2026-10-14 Rolling window summaries
+ *  2026-10-14 Multiple test instances
+ *  2026-10-14 Configuration and autostart by module parameters
+ *  2026-10-14 Counter timestamps
+ *  2026-10-14 Callback overhead statistics
+ *  2026-10-14 Notifications via sysfs_notify()
+ *  2026-10-14 Streaming of window summaries via generic netlink
+ *  2026-10-14 Interrupt and task attribution of outliers
+ *  2026-10-14 Tracepoints
+ *  2026-10-14 Histogram dump in debugfs
+ *  2026-10-14 Cross-CPU IPI latency
+ *  2026-10-14 Idle states and CPU frequency per sample
  */
 
 #include <linux/module.h>	/* Needed by all modules */
@@ -41,42 +160,392 @@
 #include <linux/time.h>
 #include <linux/hrtimer.h>
 #include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/irqdesc.h>
+#include <linux/kernel_stat.h>
+#include <linux/moduleparam.h>
+#include <linux/io.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
 #include <linux/device.h>
 #include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/seqlock.h>
+#include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/irq_work.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
+#include <linux/clocksource.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/cpuidle.h>
+#include <linux/cpufreq.h>
+#include <linux/pm_qos.h>
+#include <trace/events/power.h>   // before CREATE_TRACE_POINTS, only the probes are registered
+#include <net/genetlink.h>
 #include <asm/div64.h>
+#ifdef CONFIG_ARM_ARCH_TIMER
+#include <clocksource/arm_arch_timer.h>
+#include <asm/arch_timer.h>
+#endif
+
+#include "lattest.h"
+#define CREATE_TRACE_POINTS
+#include "lattest_trace.h"
 
 //////////////////////////////////////////////////////////////////////////////
 // Configuration /////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-// define GPIO number, can be left undefined to disable the use of a GPIO
+// default GPIO number, can be changed with the module parameter "gpio", -1
+// disables the use of a GPIO
 // GPIO 4 = physical pin 7, see e.g., http://pinout.xyz/pinout/pin7_gpio4
 #define GPIO_LATTEST_TOGGLE 4
 
-#define HIST_BIN_MAX  256  // maximum number of histogram bins
+// BCM2835/BCM2711 GPIO registers, see "BCM2835 ARM Peripherals", section 6.1
+#define BCM2835_GPSET0     0x1C
+#define BCM2835_GPCLR0     0x28
+#define BCM2835_GPIO_NUM   58     // BCM2711 has 58, BCM2835 54 GPIOs
+#define BCM2835_GPIO_SIZE  0xB4
+
+#define HIST_BIN_MAX  65536       // maximum number of histogram bins
+#define HIST_BIN_WIDTH_MAX 1000000000  // maximum width of a histogram bin: 1s
+
+#define LOG_HIST_SUB_BITS 7    // log-linear histogram: 2^(n-1) bins per power of 2, i.e., <= 1.6% relative error
+#define LOG_HIST_MAX_BITS 34   // log-linear histogram: values up to 2^34ns = ~17s
+
+#define PERIOD_NS_MIN 10000        // minimum period:  10us, shorter periods lock up the CPU
+#define PERIOD_NS_MAX 1000000000   // maximum period: 1s
+
+#define LATTEST_INSTANCES_MAX 8     // maximum number of test instances
+
+#define RING_SIZE_MAX (1 << 20)    // maximum number of samples per CPU ring buffer
+
+#define OUTLIER_LOG_SIZE 64        // number of outliers kept, older ones are overwritten, power of 2
+#define OUTLIER_TEXT_LINES 24      // newest outliers shown by the text attribute, to fit into a page
+#define OUTLIER_IRQS 3             // device IRQs with the most interrupts stored per outlier
+
+#define WINDOW_NUM 1024           // number of finished windows kept per CPU, power of 2
+#define WINDOW_MS_MAX 3600000     // maximum length of a window: 1h
+#define WINDOW_TEXT_LINES 36      // windows shown by the text attribute, to fit into a page
+#define STREAM_INTERVAL_MIN_MS 100  // shortest interval of the stream worker, for short windows
+
+#define TS_CALIBRATE_MS 20        // counter timestamps: interval to measure the counter rate at the start
+
+#define LOAD_BUF_SIZE (8 << 20)    // buffer per load thread for "cache" and "membw", larger than the L2 cache
+#define LOAD_IPI_BURST 64          // self-IPIs per loop of a "ipi" load thread
+#define LOAD_SPIN_HOLD_US 10       // time a "spinlock" load thread holds the lock with interrupts disabled
 
 //////////////////////////////////////////////////////////////////////////////
 // Variables /////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-#ifdef GPIO_LATTEST_TOGGLE
+static int gpio_lattest = GPIO_LATTEST_TOGGLE;
+module_param_named(gpio, gpio_lattest, int, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(gpio, "GPIO to toggle at each timer expiry, -1 to disable");
+static bool gpio_direct;
+module_param(gpio_direct, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(gpio_direct, "Toggle the GPIO by writing the BCM2835/BCM2711 GPSET/GPCLR registers directly");
+static ulong gpio_phys;
+module_param(gpio_phys, ulong, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(gpio_phys, "Physical address of the GPIO registers for gpio_direct, default from the device tree");
+static int gpio_lattest_irq = -1;
+module_param_named(gpio_irq, gpio_lattest_irq, int, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(gpio_irq, "GPIO input wired to the toggled GPIO to measure the loopback IRQ latency, -1 to disable");
+
 static volatile int gpio_lattest_value;   // same type as used for gpio_set_value()
-#endif // GPIO_LATTEST_TOGGLE
-
-static volatile unsigned long period_ms;   // period of the hrtimer
-static struct hrtimer my_hrtimer;          // hrtimer information structure
-static volatile int runcount;              // number of timer occurences to run, is set >0 and decremented, -1 denotes infinite runs
-static volatile long long last_now_ns;     // last value of "now" in ns, is set to 0 to denote the first timer run
-
-// statistics
-static volatile long long hist_bin_num;    // config: number of used bins (<= HIST_BIN_MAX)
-static volatile long long hist_bin_width;  // config: width of bins in ns
-static volatile long long stat_min;
-static volatile long long stat_max;
-static volatile long long stat_num;
-static volatile long long stat_sum;
-static volatile long long stat_sumsq;
-static volatile unsigned int histogram[HIST_BIN_MAX];
+static void __iomem *gpio_regs;            // GPIO registers for gpio_direct, NULL if not used
+static u32 gpio_mask;                      // bit of gpio_lattest in GPSETn/GPCLRn
+static void __iomem *gpio_set_reg;         // GPSETn of gpio_lattest
+static void __iomem *gpio_clr_reg;         // GPCLRn of gpio_lattest
+
+static int lattest_instances = 1;
+module_param_named(instances, lattest_instances, int, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(instances, "Number of independent test instances, LatTest, LatTest1, ...");
+
+// configuration of the first instance at load time, see lattest_params_apply()
+static char *param_period_ns;
+module_param_named(period_ns, param_period_ns, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(period_ns, "Period in ns");
+static char *param_cpus;
+module_param_named(cpus, param_cpus, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(cpus, "List of CPUs to run a timer on, e.g. 0-3 or 2,3");
+static char *param_timer_mode;
+module_param_named(timer_mode, param_timer_mode, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(timer_mode, "hrtimer mode, e.g. rel,pinned,soft");
+static char *param_hist_mode;
+module_param_named(hist_mode, param_hist_mode, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(hist_mode, "Histogram mode: linear or log");
+static char *param_config;
+module_param_named(config, param_config, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(config, "Histogram bins: <count>,<width>[,<offset>], width and offset in ns");
+static char *param_autostart;
+module_param_named(autostart, param_autostart, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(autostart, "Start the measurement at load time: number of periods or infinite");
+
+// 128 bit unsigned integer, there is no portable 128 bit type for 32 bit ARM
+struct ull128 {
+  u64 hi;
+  u64 lo;
+};
+
+// statistics config
+enum lattest_hist_mode {
+  HIST_MODE_LINEAR = LATTEST_HIST_LINEAR,  // hist_bin_num bins of hist_bin_width
+  HIST_MODE_LOG    = LATTEST_HIST_LOG,     // log-linear bins, see lattest_loglin_bin()
+};
+
+// statistics, one block per CPU so the timers never share a cacheline
+struct lattest_stat {
+  long long min;
+  long long max;
+  long long num;
+  long long sum;
+  struct ull128 sumsq;                     // 128 bit, a 64 bit sum of squares overflows after a few million samples
+  long long overruns;                      // latency only: total number of missed expiries
+  long long overrun_max;                   // latency only: most expiries missed in a row
+  long long overrun_max_ns;                // latency only: time of the callback after overrun_max
+  unsigned int hist_num;                   // number of histogram bins
+  u64 *histogram;                          // allocated by lattest_stat_alloc(), 64 bit bins don't wrap in multi-day runs
+};
+
+// timestamp source of the timer callbacks
+enum lattest_ts_source {
+  TS_KTIME,                                // hrtimer_cb_get_time(), i.e., the clocksource via the timekeeping
+  TS_COUNTER,                              // ARM generic timer counter, calibrated against the timer's clock
+};
+static const char * const lattest_ts_names[] = { "ktime", "counter" };
+
+// events for poll() on .../event, bit numbers
+enum lattest_event {
+  EVENT_DONE,                              // all timers of a run have finished
+  EVENT_OUTLIER,                           // a latency above the outlier threshold
+};
+
+// latency per idle state: bucket of LATTEST_IDLE_UNKNOWN, LATTEST_IDLE_BUSY,
+// then the cpuidle states
+#define IDLE_BUCKETS (CPUIDLE_STATE_MAX + 2)
+#define IDLE_BUCKET(state) ((state) - LATTEST_IDLE_UNKNOWN)
+
+struct lattest_inst;
+
+// per-CPU timer state, only ever written by the timer running on that CPU
+// (and by store_control_cb() while that timer is stopped)
+struct lattest_cpu {
+  struct lattest_inst *li;                 // instance this timer belongs to
+  struct hrtimer timer;                    // hrtimer information structure
+  volatile int runcount;                   // number of timer occurences to run, is set >0 and decremented, -1 denotes infinite runs
+  volatile long long last_now_ns;          // last value of "now" in ns, is set to 0 to denote the first timer run
+  seqcount_t seq;                          // protects stat, lat and thr, written by the timer and the thread of this CPU only
+  struct lattest_stat stat;                // jitter: callback-to-callback delta minus period
+  struct lattest_stat lat;                 // latency: callback time minus programmed expiry
+  struct lattest_stat thr;                 // thread latency: thread running minus programmed expiry
+  volatile int swap_req;                   // set to let the timer swap stat/lat/thr/ovh with stat_last/lat_last/thr_last/ovh_last
+  struct lattest_stat stat_last;           // jitter of the interval before the last reset
+  struct lattest_stat lat_last;            // latency of the interval before the last reset
+  struct lattest_stat thr_last;            // thread latency of the interval before the last reset
+  struct lattest_stat ovh;                 // overhead: execution time of the timer callback itself
+  struct lattest_stat ovh_last;            // overhead of the interval before the last reset
+  struct lattest_ring_header *ring;        // raw sample ring buffer, NULL if disabled, mapped writable to userspace
+  struct lattest_sample *ring_data;        // samples of ring, never derived from its header
+  u32 ring_mask;                           // number of samples minus 1
+  u32 ring_head;                           // number of samples written, published in ring->head
+  u32 ring_dropped;                        // number of samples dropped, published in ring->dropped
+  struct task_struct *thread;              // wakeup thread bound to this CPU, NULL if disabled
+  volatile long long thr_expires_ns;       // expiry the thread was woken for
+  volatile int thr_pending;                // set by the timer, cleared by the thread when it has run
+  volatile long long thr_missed;           // wakeups while the thread was still pending
+  struct lattest_window win_cur;           // current rolling window
+  long long win_end_ns;                    // end of win_cur, 0 before the first callback
+  struct lattest_window *win;              // WINDOW_NUM finished windows, only written by the timer
+  volatile unsigned int win_head;          // number of finished windows, the last WINDOW_NUM are in win
+  unsigned int stream_tail;                // number of finished windows sent or lost by the stream worker
+  u64 ts_cyc0;                             // counter timestamps: counter value at the last calibration
+  long long ts_ns0;                        // counter timestamps: time on the timer's clock at the last calibration
+  u32 ts_mult;                             // counter timestamps: ns = (cycles * ts_mult) >> ts_shift
+  struct lattest_stat *ipi;                // IPI latency from each source CPU to this one, nr_cpu_ids blocks, NULL if disabled
+  seqcount_t ipi_seq;                      // protects ipi, written by the IPI handler on this CPU only
+  call_single_data_t ipi_csd;              // IPI to ipi_target, sent by the timer of this CPU
+  int ipi_src;                             // this CPU, for the handler on the target
+  int ipi_target;                          // CPU the last IPI was sent to
+  volatile long long ipi_sent_ns;          // ktime_get_ns() when the IPI was sent
+  volatile int ipi_pending;                // set by the timer, cleared by the handler on the target
+  volatile long long ipi_missed;           // expiries without IPI because the previous one was still pending
+  unsigned int att_hardirqs;               // attribution: interrupts of this CPU at the previous callback
+  unsigned int att_softirqs[NR_SOFTIRQS];  // attribution: softirqs of this CPU at the previous callback
+  unsigned int *att_irqs;                  // attribution: interrupts of this CPU per IRQ of att_irq_list at the last outlier
+  pid_t att_pid;                           // attribution: task interrupted by the previous callback, for thread outliers
+  char att_comm[TASK_COMM_LEN];
+  struct lattest_stat idle[IDLE_BUCKETS];  // latency per idle state left, counters only, since the start
+};
+
+
+// GPIO loopback IRQ, its handler is the only writer of irq_stat
+static int lattest_irq = -1;               // IRQ of gpio_lattest_irq, -1 if not used
+static volatile long long gpio_toggle_ns;  // time of the last GPIO edge
+static volatile long long gpio_toggles;    // number of GPIO edges since the start
+static seqcount_t irq_seq;                 // protects irq_stat
+static struct lattest_stat irq_stat;       // loopback latency: IRQ handler time minus GPIO edge
+static struct lattest_stat irq_stat_last;  // loopback latency of the interval before the last reset
+
+// outlier log
+enum lattest_outlier_source {
+  OUTLIER_TIMER,                           // callback latency
+  OUTLIER_THREAD,                          // wakeup thread latency
+};
+static const char * const lattest_outlier_names[] = { "timer", "thread" };
+static const char * const lattest_softirq_names[NR_SOFTIRQS] = {
+  [HI_SOFTIRQ]       = "HI",
+  [TIMER_SOFTIRQ]    = "TIMER",
+  [NET_TX_SOFTIRQ]   = "NET_TX",
+  [NET_RX_SOFTIRQ]   = "NET_RX",
+  [BLOCK_SOFTIRQ]    = "BLOCK",
+  [IRQ_POLL_SOFTIRQ] = "IRQ_POLL",
+  [TASKLET_SOFTIRQ]  = "TASKLET",
+  [SCHED_SOFTIRQ]    = "SCHED",
+  [HRTIMER_SOFTIRQ]  = "HRTIMER",
+  [RCU_SOFTIRQ]      = "RCU",
+};
+// what happened on the CPU of an outlier since the previous callback
+struct lattest_attribution {
+  unsigned int hardirqs;                   // interrupts, including the timer interrupt itself
+  unsigned int softirqs[NR_SOFTIRQS];      // softirqs raised, per type
+  unsigned int irq[OUTLIER_IRQS];          // device IRQs with the most interrupts since the previous outlier of the CPU, per-CPU IRQs like the timer and IPIs are left out
+  unsigned int irq_num[OUTLIER_IRQS];      // their interrupts, 0 = unused
+  pid_t pid;                               // task interrupted by the timer
+  char comm[TASK_COMM_LEN];
+};
+struct lattest_outlier {
+  long long timestamp_ns;                  // time the outlier was detected, on the timer's clock
+  long long latency_ns;
+  int cpu;
+  int source;                              // enum lattest_outlier_source
+  struct lattest_attribution att;
+};
+
+// background load
+enum lattest_load_type {
+  LOAD_NONE,
+  LOAD_CACHE,                              // walk a buffer larger than the caches
+  LOAD_MEMBW,                              // memcpy() within a buffer larger than the caches
+  LOAD_IPI,                                // interrupt storm by self-IPIs via irq_work
+  LOAD_SPINLOCK,                           // contend on a raw spinlock with interrupts disabled
+};
+static const char * const lattest_load_names[] = { "none", "cache", "membw", "ipi", "spinlock" };
+static volatile int load_type;             // config: enum lattest_load_type, applied at the next start
+static struct cpumask load_cpus;           // config: CPUs to run a load thread on
+
+struct lattest_load {
+  struct task_struct *thread;              // load thread bound to this CPU, NULL if none
+  int type;                                // enum lattest_load_type of the thread
+  void *buf;                               // LOAD_BUF_SIZE for LOAD_CACHE and LOAD_MEMBW, else NULL
+  struct irq_work work;                    // self-IPI for LOAD_IPI
+  volatile unsigned long long loops;       // number of load loops done
+};
+static DEFINE_PER_CPU(struct lattest_load, lattest_load_data);
+static DEFINE_RAW_SPINLOCK(load_lock);     // contended by the LOAD_SPINLOCK threads
+
+// idle states and frequencies of all CPUs, written by the probes of the
+// cpu_idle and cpu_frequency tracepoints, shared by the instances
+static DEFINE_PER_CPU(int, lattest_idle_state);           // cpuidle state last entered, LATTEST_IDLE_UNKNOWN before
+static DEFINE_PER_CPU(unsigned int, lattest_freq_khz);    // current frequency, 0 if unknown
+static DEFINE_PER_CPU(unsigned int, lattest_freq_changes); // frequency changes since the module was loaded
+static bool lattest_idle_traced;           // the cpu_idle probe is registered
+static bool lattest_freq_traced;           // the cpu_frequency probe is registered
+
+// binary snapshots: statistics_bin, statistics_last_bin and windows_bin,
+// each reader gets its own, see lattest_snapshot_slot()
+#define SNAPSHOT_WINDOWS 2
+#define SNAPSHOT_READERS 4        // concurrent readers of each binary snapshot
+struct lattest_snapshot_buf {
+  const struct file *filp;       // open file the snapshot was taken for, NULL if unused
+  unsigned long used;            // snapshot_used at its last read, the least recently used one is reused
+  void   *buf;
+  size_t  size;
+};
+
+// test instance with its own device, configuration, timers and statistics
+struct lattest_inst {
+  int id;                                  // 0 for LatTest, n for LatTest<n>
+  struct device *dev;                      // /sys/class/LatTest/LatTest<n>/ and /dev/LatTest<n>
+  volatile int gpio_cpu;                   // CPU whose timer toggles the GPIO, -1 except for instance 0
+
+  // timers
+  volatile ktime_t period_kt;              // period of the hrtimer
+  struct cpumask cpus;                     // config: CPUs to run a timer on
+  volatile int timer_mode;                 // config: enum hrtimer_mode, applied at the next start
+  volatile clockid_t timer_clock;          // config: clock of the hrtimer, applied at the next start
+  volatile int thread_prio;                // config: SCHED_FIFO priority of the wakeup threads, 0 = disabled, applied at the next start
+  volatile bool ipi;                       // config: the timers send IPIs to the other CPUs, applied at the next start
+  struct cpumask run_cpus;                 // CPUs of the current or last run, which have statistics, also the IPI targets
+  volatile int idle_qos_us;                // config: CPU latency limit requested during a run, -1 = disabled, applied at the next start
+  struct pm_qos_request qos_req;           // active from the start until the end of a run
+  volatile int timestamp;                  // config: enum lattest_ts_source, applied at the next start
+  u32 ts_rate;                             // counter timestamps: frequency of the counter in Hz
+  u32 ts_mult;                             // counter timestamps: ts_mult measured at the start
+  u32 ts_shift;
+  struct lattest_cpu __percpu *cpu_data;   // per-CPU timer state
+
+  // statistics
+  volatile int hist_mode;                  // config: enum lattest_hist_mode
+  volatile long long hist_bin_num;         // config: number of used bins (<= HIST_BIN_MAX)
+  volatile long long hist_bin_width;       // config: width of bins in ns
+  volatile long long hist_bin_offset;      // config: shift of all bins in ns
+  struct mutex stat_mutex;                 // serializes readers of the statistics against reset and (re-)allocation
+  struct mutex reset_mutex;                // serializes the interval resets, which drop stat_mutex while waiting for the timers
+  struct lattest_snapshot_buf snapshot_buf[3][SNAPSHOT_READERS];
+  unsigned long snapshot_used;             // number of snapshot reads
+  struct mutex snapshot_mutex;             // protects snapshot_buf and snapshot_used
+
+  // outlier log
+  volatile long long outlier_threshold_ns; // config: latencies above are logged, 0 = disabled
+  volatile bool breaktrace;                // config: call tracing_off() at the first outlier
+  volatile bool breaktrace_done;           // tracing_off() was called since the start
+  struct lattest_outlier outlier_log[OUTLIER_LOG_SIZE];
+  long long outlier_num;                   // number of outliers since the start, the last OUTLIER_LOG_SIZE are in outlier_log
+  raw_spinlock_t outlier_lock;             // protects outlier_log and outlier_num, taken by the timers of all CPUs
+  unsigned int *att_irq_list;              // attribution: device IRQs with a handler at the start, the only ones scanned
+  unsigned int att_irq_num;                // entries in att_irq_list
+  unsigned int att_irq_max;                // size of att_irq_list and of each att_irqs, nr_irqs at init
+
+  bool dump_sparse;                        // config: the debugfs histogram dump only has the non-empty bins
+
+  // rolling windows
+  volatile long long window_ns;            // config: length of a window, 0 = disabled
+
+  // streaming of the windows
+  volatile bool stream;                    // config: multicast the finished windows via generic netlink
+  struct delayed_work stream_work;         // sends the windows, so the timers only fill the window rings
+  unsigned int stream_lost;                // windows overwritten before they were sent
+
+  // events
+  atomic_t timers_active;                  // timers of the current run which haven't finished yet
+  volatile bool stopped;                   // the current run was stopped via control before its end
+  unsigned long event_pending;             // EVENT_* bits raised since the last notification
+  struct work_struct event_work;           // notifies userspace, sysfs_notify() can sleep
+  volatile unsigned int event_num;         // number of notifications
+  volatile unsigned int event_last;        // EVENT_* bits of the last notification
+
+  // raw sample ring buffers
+  unsigned int ring_size;                  // config: number of samples per CPU, power of 2, 0 = disabled
+  struct mutex ring_mutex;                 // serializes (re-)allocation against mmap()
+  atomic_t ring_mapped;                    // number of VMAs mapping a ring
+};
+
+static struct lattest_inst *lattest_insts[LATTEST_INSTANCES_MAX];
 
 /*
 hist_bin_num:
@@ -97,12 +566,41 @@ general: (hist_bin_width>>1)+(i-((hist_bin_num+1)>>1)*hist_bin_width
 
 general: lower bound = (hist_bin_width>>1)*(hist_bin_num&1)+(i-((hist_bin_num+1)>>1)*hist_bin_width
 
+All bins are shifted by hist_bin_offset, i.e., it is the center of the range.
+
 Find bin for value:
 -------------------
 (diff_ns - hist_bin_lower(0))/hist_bin_width
 */
 
-#define HIST_BIN_LOW(i) ((hist_bin_width>>1)*(hist_bin_num&1)+((i)-((hist_bin_num+1)>>1))*hist_bin_width)
+#define HIST_BIN_LOW(li, i) ((li)->hist_bin_offset+((li)->hist_bin_width>>1)*((li)->hist_bin_num&1)+((i)-(((li)->hist_bin_num+1)>>1))*(li)->hist_bin_width)
+
+/*
+The wakeup latency is never negative, therefore its histogram starts at
+hist_bin_offset (usually 0):
+0: 0..999, 1: 1000..1999, ..., 19: 19000..
+*/
+
+#define HIST_LAT_BIN_LOW(li, i) ((li)->hist_bin_offset+(i)*(li)->hist_bin_width)
+
+/*
+Log-linear histogram (like HdrHistogram) of the magnitude u:
+ - u < 2^S: one bin per ns, index = u
+ - above:   2^(S-1) bins per power of 2, with s = fls64(u)-S the bin index is
+            (s << (S-1)) + (u >> s), where u >> s is in 2^(S-1)..2^S-1
+e.g., S = 7: 0..127 --> 0..127, 128..129 --> 128, ..., 256..259 --> 192, ...
+The bin width relative to its lower bound is at most 2^-(S-1).
+
+The jitter histogram uses LOG_HIST_HALF bins for negative values (mirrored,
+-1 is next to 0) followed by LOG_HIST_HALF bins for positive values. The
+latency histogram only has the positive half.
+*/
+
+#define LOG_HIST_HALF (((LOG_HIST_MAX_BITS-LOG_HIST_SUB_BITS)+2) << (LOG_HIST_SUB_BITS-1))
+
+// iterate over all CPUs of the current or last run, only their statistics
+// were reset at its start
+#define for_each_lattest_cpu(li, cpu) for_each_cpu((cpu), &(li)->run_cpus)
 
 //////////////////////////////////////////////////////////////////////////////
 // Helper Functions //////////////////////////////////////////////////////////
@@ -114,16 +612,100 @@ Find bin for value:
  * In the Linux kernel, we can't use the inline division with '/', see
  *   http://stackoverflow.com/questions/25623956/aeabi-ldivmod-undefined-when-compiling-kernel-module
  *
- * Attention: do_div actually is uint64 / uint32!
+ * Attention: do_div actually is uint64 / uint32, so div64_u64() is used,
+ * which is just as fast if the divisor fits into 32 bit.
  */
 long long div_ll(long long n, long long base) {
   long long a = abs(n);
   long long b = abs(base);
-  do_div(a, b);   // quotient in a, returns the remainder, but it is unused here
+  a = div64_u64(a, b);
   if ((n < 0) ^ (base < 0)) a = -a;
   return a;
 }
 
+/**
+ * Add a 64 bit value to a 128 bit value
+ */
+static inline void ull128_add_u64(struct ull128 *a, u64 b) {
+  a->lo += b;
+  if (a->lo < b) a->hi++;   // carry
+}
+
+/**
+ * Add a 128 bit value to a 128 bit value
+ */
+static void ull128_add(struct ull128 *a, const struct ull128 *b) {
+  ull128_add_u64(a, b->lo);
+  a->hi += b->hi;
+}
+
+/**
+ * Subtract b from a, b must not be larger than a
+ */
+static void ull128_sub(struct ull128 *a, const struct ull128 *b) {
+  if (a->lo < b->lo) a->hi--;   // borrow
+  a->lo -= b->lo;
+  a->hi -= b->hi;
+}
+
+/**
+ * Check a < b
+ */
+static int ull128_lt(const struct ull128 *a, const struct ull128 *b) {
+  return (a->hi < b->hi) || ((a->hi == b->hi) && (a->lo < b->lo));
+}
+
+/**
+ * Multiply 64 bit by 64 bit with a 128 bit result
+ */
+static struct ull128 ull128_mul(u64 a, u64 b) {
+  struct ull128 r;
+  u64 p0 = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+  u64 p1 = (a & 0xFFFFFFFF) * (b >> 32);
+  u64 p2 = (a >> 32)        * (b & 0xFFFFFFFF);
+  u64 p3 = (a >> 32)        * (b >> 32);
+  u64 mid = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+  r.lo = (mid << 32) | (p0 & 0xFFFFFFFF);
+  r.hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+  return r;
+}
+
+/**
+ * Divide 128 bit by 64 bit, the quotient replaces a, returns the remainder
+ *
+ * Simple shift-and-subtract, this is only used to report statistics.
+ */
+static u64 ull128_div_u64(struct ull128 *a, u64 b) {
+  u64 rem = 0;
+  u64 carry;
+  int i;
+  for (i = 0; i < 128; i++) {
+    carry  = rem >> 63;
+    rem    = (rem << 1) | (a->hi >> 63);
+    a->hi  = (a->hi << 1) | (a->lo >> 63);
+    a->lo  = a->lo << 1;
+    if (carry || rem >= b) {
+      rem -= b;
+      a->lo |= 1;
+    }
+  }
+  return rem;
+}
+
+/**
+ * Print a 128 bit value in decimal
+ */
+static int ull128_scnprintf(char *buf, size_t size, struct ull128 a) {
+  const u64 e18 = 1000000000000000000ULL;
+  u64 low;
+  u64 mid;
+  low = ull128_div_u64(&a, e18);
+  if (a.hi == 0 && a.lo == 0) return scnprintf(buf, size, "%llu", low);
+  mid = ull128_div_u64(&a, e18);   // remaining value is < 2^128/10^36 = 340
+  if (a.lo == 0) return scnprintf(buf, size, "%llu%018llu", mid, low);
+  return scnprintf(buf, size, "%llu%018llu%018llu", a.lo, mid, low);
+}
+
 // taken from
 // http://stackoverflow.com/questions/1100090/looking-for-an-efficient-integer-square-root-algorithm-for-arm-thumb2
 // and changed to 64 bit
@@ -172,305 +754,4258 @@ uint64_t isqrtu64(uint64_t a_nInput) {
   return res;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// Timer Function ////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
-
-static enum hrtimer_restart lattest_timer_function(struct hrtimer *timer) {
-  unsigned long tjnow;
-  ktime_t now_kt;
-  long long now_ns;
-  ktime_t period_kt;
-  long long diff_ns;
-  int ret_overrun;
-  long long hist_bin;
-
-#ifdef GPIO_LATTEST_TOGGLE
-  gpio_set_value(GPIO_LATTEST_TOGGLE, gpio_lattest_value);
-  gpio_lattest_value = !gpio_lattest_value;
-#endif // GPIO_LATTEST_TOGGLE
-
-  tjnow       = jiffies;
-  now_kt      = hrtimer_cb_get_time(&my_hrtimer);
-  now_ns      = ktime_to_ns(now_kt);
-  period_kt   = ktime_set(0, period_ms*1000000);
-  ret_overrun = hrtimer_forward(&my_hrtimer, now_kt, period_kt);
-  if (last_now_ns != 0) {
-    diff_ns     = now_ns - last_now_ns;
-//    printk(KERN_INFO " lattest jiffies %lu ; ret: %d ; ktnsec: %lld = +%ldms %+lldns\n",
-//      tjnow, ret_overrun, now_ns, period_ms, diff_ns - period_ms*1000000);
-    // statistics
-    diff_ns = diff_ns - period_ms*1000000;   // reuse variable
-
-    if (diff_ns < stat_min) stat_min = diff_ns;
-    if (diff_ns > stat_max) stat_max = diff_ns;
-    stat_num++;
-    stat_sum   += diff_ns;
-    stat_sumsq += diff_ns*diff_ns;
-
-    // e.g., -1000..-1 --> 9, 0..999 --> 10, 1000..2000 --> 11
-    // no 64/64 bit division built in: hist_bin = (diff_ns - HIST_BIN_LOW(0)) / hist_bin_width;
-    hist_bin = div_ll(diff_ns - HIST_BIN_LOW(0), hist_bin_width);
-    if (hist_bin < 0) hist_bin = 0;
-    if (hist_bin >= hist_bin_num) hist_bin = hist_bin_num-1;
-    histogram[hist_bin]++;
-  }
-  last_now_ns = now_ns;
+/**
+ * Log-linear bin of the magnitude u, without any division
+ */
+static inline unsigned int lattest_loglin_bin(u64 u) {
+  unsigned int s;
+  if (u < (1 << LOG_HIST_SUB_BITS)) return u;
+  if (u >> LOG_HIST_MAX_BITS) return LOG_HIST_HALF-1;
+  s = fls64(u) - LOG_HIST_SUB_BITS;
+  return (s << (LOG_HIST_SUB_BITS-1)) + (unsigned int)(u >> s);
+}
 
-  if (runcount > 0) {
-    // decrement counter
-    runcount--;
-    return HRTIMER_RESTART;
-  } else if (runcount == 0) {
-    // finished, don't restart the timer
-    return HRTIMER_NORESTART;
-  } else /* if (runcount < 0) */ {
-    // run infinitely
-    return HRTIMER_RESTART;
-  }
+/**
+ * Lower bound of log-linear bin i, i.e., inverse of lattest_loglin_bin()
+ */
+static long long lattest_loglin_low(unsigned int i) {
+  unsigned int s;
+  if (i < (1 << LOG_HIST_SUB_BITS)) return i;
+  s = (i >> (LOG_HIST_SUB_BITS-1)) - 1;
+  return (long long)(i - (s << (LOG_HIST_SUB_BITS-1))) << s;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// SysFS /////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
+/**
+ * Number of bins of the jitter histogram with histogram mode and bin count
+ */
+static unsigned int lattest_jitter_bins_of(int mode, long long bin_num) {
+  return (mode == HIST_MODE_LOG) ? 2*LOG_HIST_HALF : bin_num;
+}
 
-/*
- *   .../status ...... (r) query current status: inactive/running, period, resolution, ...
- *   .../period ...... (rw) set/get period in ms
- *   .../control ..... (w) start (with number of periods) / stop
- *   .../config ...... (rw) configure statistics: number and width of histogram bins
- *   .../statistics .. (r) statistics: min, max, mean, stddev, histogram
+/**
+ * Number of bins of the latency histogram with histogram mode and bin count
  */
+static unsigned int lattest_latency_bins_of(int mode, long long bin_num) {
+  return (mode == HIST_MODE_LOG) ? LOG_HIST_HALF : bin_num;
+}
 
 /**
- * Query current status: inactive/running, period, resolution, ...
+ * Number of bins of the jitter histogram
  */
-static ssize_t show_status_cb(struct device *dev, struct device_attribute *attr, char *buf) {
-  return scnprintf(buf, PAGE_SIZE, "HZ: %d\nJiffie Period: %d ms\nHR timer resolution: %d ns\nLatTest period: %ld ms\nRunCount: %d\nStatus: %s\n",
-    HZ, 1000/HZ, hrtimer_resolution, period_ms, runcount, ((runcount != 0) ? "running" : "stopped"));
+static unsigned int lattest_jitter_bins(const struct lattest_inst *li) {
+  return lattest_jitter_bins_of(li->hist_mode, li->hist_bin_num);
 }
 
 /**
- * Query period
+ * Number of bins of the latency histogram
  */
-static ssize_t show_period_cb(struct device *dev, struct device_attribute *attr, char *buf) {
-  return scnprintf(buf, PAGE_SIZE, "%ld\n", period_ms);
+static unsigned int lattest_latency_bins(const struct lattest_inst *li) {
+  return lattest_latency_bins_of(li->hist_mode, li->hist_bin_num);
 }
 
 /**
- * Set period in ms
+ * Histogram bin of a jitter value
  *
- * Max. 1 second allowed
+ * Only limited at the low end, lattest_stat_add() limits it to the bins of
+ * the statistics block.
  */
-static ssize_t store_period_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
-  unsigned int new_period;
-  if (runcount != 0) return -EINVAL;   // timer running
-
-  if (kstrtouint(buf, 10, &new_period) < 0) return -EINVAL;
-  // max. 1 second allowed
-  if (new_period> 1000) return -EINVAL;
+static inline long long lattest_jitter_bin(const struct lattest_inst *li, long long diff_ns) {
+  long long hist_bin;
+  if (li->hist_mode == HIST_MODE_LOG) {
+    if (diff_ns >= 0) return LOG_HIST_HALF + lattest_loglin_bin(diff_ns);
+    return LOG_HIST_HALF-1 - lattest_loglin_bin(-(diff_ns+1));
+  }
+  // e.g., -1000..-1 --> 9, 0..999 --> 10, 1000..2000 --> 11
+  // no 64/64 bit division built in: hist_bin = (diff_ns - HIST_BIN_LOW(0)) / hist_bin_width;
+  hist_bin = div_ll(diff_ns - HIST_BIN_LOW(li, 0), li->hist_bin_width);
+  if (hist_bin < 0) hist_bin = 0;
+  return hist_bin;
+}
 
-  period_ms = new_period;
-  printk(KERN_INFO "lattest: Setting period to %ld ms", period_ms);
-  return count;
+/**
+ * Lower bound of jitter histogram bin i
+ */
+static long long lattest_jitter_bin_low(const struct lattest_inst *li, unsigned int i) {
+  if (li->hist_mode == HIST_MODE_LOG) {
+    if (i >= LOG_HIST_HALF) return lattest_loglin_low(i - LOG_HIST_HALF);
+    return -lattest_loglin_low(LOG_HIST_HALF - i);
+  }
+  return HIST_BIN_LOW(li, i);
 }
 
 /**
- * Start (with number of periods or infinite) / stop
+ * Histogram bin of a latency value
  *
- * "infinite"
- * nnn
- * "stop"
+ * Only limited at the low end, like lattest_jitter_bin().
  */
-static ssize_t store_control_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
-  int new_runcount;
-  ktime_t period_kt;
-
-  if (strncmp(buf, "stop", min((size_t)4, count)) == 0) {
-    // stop the timer
-    printk(KERN_INFO "lattest: Stopping the timer.");
-    runcount = 0;
-    return count;
-  } else if (strncmp(buf, "infinite", min((size_t)8, count)) == 0) {
-    if (runcount != 0) return -EINVAL;   // timer already running
-    // run infinitely
-    runcount = -1;
-    printk(KERN_INFO "lattest: Starting the timer to run infinite times.");
-  } else {
-    if (runcount != 0) return -EINVAL;   // timer already running
-    // run a given number of times
-    if (kstrtoint(buf, 10, &new_runcount) < 0) return -EINVAL;
-    if (new_runcount <= 0) return -EINVAL;
-    // actually, kstrto*() only changes the result on success, but here the
-    // compiler complains because the 'volatile' qualifier is discareded,
-    // therefore we use an intermediate variable
-    runcount = new_runcount;
-    printk(KERN_INFO "lattest: Starting the timer to run %d times.", runcount);
-  }
-  // prepare for timer
-  last_now_ns = 0;   // to denote the first run
-  // reset statistics
-  stat_min   = LLONG_MAX;
-  stat_max   = LLONG_MIN;
-  stat_num   = 0;
-  stat_sum   = 0;
-  stat_sumsq = 0;
-  memset((void*)histogram, 0, sizeof(histogram[0])*HIST_BIN_MAX);
-
-  // start timer
-  period_kt = ktime_set(0, period_ms*1000000);
-  hrtimer_start(&my_hrtimer, period_kt, HRTIMER_MODE_REL);
-
-  return count;
+static inline long long lattest_latency_bin(const struct lattest_inst *li, long long lat_ns) {
+  long long hist_bin;
+  if (lat_ns < 0) lat_ns = 0;   // expiry in the future isn't possible, but be safe
+  if (li->hist_mode == HIST_MODE_LOG) return lattest_loglin_bin(lat_ns);
+  // no 64/64 bit division built in: hist_bin = (lat_ns - HIST_LAT_BIN_LOW(0)) / hist_bin_width;
+  hist_bin = div_ll(lat_ns - HIST_LAT_BIN_LOW(li, 0), li->hist_bin_width);
+  if (hist_bin < 0) hist_bin = 0;
+  return hist_bin;
 }
 
 /**
- * Query statistics configuration
+ * Lower bound of latency histogram bin i
  */
-static ssize_t show_config_cb(struct device *dev, struct device_attribute *attr, char *buf) {
-  return scnprintf(buf, PAGE_SIZE, "Histogram bin width: %lld\nHistogram bin count: %lld\n", hist_bin_width, hist_bin_num);
+static long long lattest_latency_bin_low(const struct lattest_inst *li, unsigned int i) {
+  if (li->hist_mode == HIST_MODE_LOG) return lattest_loglin_low(i);
+  return HIST_LAT_BIN_LOW(li, i);
 }
 
 /**
- * Configure statistics: number and width of histogram bins
+ * Reset a statistics block
  */
-static ssize_t store_config_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
-  if (runcount != 0) return -EINVAL;   // timer running
-
-  // TODO: implement
+static void lattest_stat_reset(struct lattest_stat *stat) {
+  stat->min   = LLONG_MAX;
+  stat->max   = LLONG_MIN;
+  stat->num   = 0;
+  stat->sum   = 0;
+  stat->sumsq.hi = 0;
+  stat->sumsq.lo = 0;
+  stat->overruns = 0;
+  stat->overrun_max = 0;
+  stat->overrun_max_ns = 0;
+  memset(stat->histogram, 0, sizeof(stat->histogram[0])*stat->hist_num);
+}
 
+/**
+ * Allocate the histogram of a statistics block and reset it
+ */
+static int lattest_stat_alloc(struct lattest_stat *stat, unsigned int hist_num) {
+  stat->histogram = kvcalloc(hist_num, sizeof(stat->histogram[0]), GFP_KERNEL);
+  if (!stat->histogram) return -ENOMEM;
+  stat->hist_num = hist_num;
+  lattest_stat_reset(stat);
   return 0;
 }
 
 /**
- * Query statistics: min, max, mean, stddev, histogram
+ * Free the histogram of a statistics block
  */
-static ssize_t show_statistics_cb(struct device *dev, struct device_attribute *attr, char *buf) {
-  ssize_t count = 0;
-  int len;
-  long long stat_mean;
-  long long stat_var;
-  long long stat_stddev;
-  int i;
+static void lattest_stat_free(struct lattest_stat *stat) {
+  kvfree(stat->histogram);
+  stat->histogram = NULL;
+  stat->hist_num  = 0;
+}
 
-  // precalculate values
-  if (stat_num > 0) {
-    stat_mean = div_ll(stat_sum, stat_num);   // replacing inline 64/64bit division
-    // StdDev = sqrt((stat_sumsq-(stat_sum^2)/stat_num)/stat_num)
-    stat_var = div_ll(stat_sumsq - div_ll(stat_sum*stat_sum, stat_num), stat_num);
-    stat_stddev = isqrtu64(stat_var);
-  } else {
-    stat_mean = 0;
-    stat_var = 0;
-    stat_stddev = 0;
-  }
-  // report histogram (we can't use the FPU in a kernel module :-( )
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Min: %+lldns\n", stat_min); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Max: %+lldns\n", stat_max); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Num: %lld\n", stat_num); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Sum: %+lldns\n", stat_sum); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Mean: ~%+lldns\n", stat_mean); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "SqSum: %lldns²\n", stat_sumsq); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Var: %lldns²\n", stat_var); count += len;
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "StdDev: %lldns\n", stat_stddev); count += len;
-  // histogram
-  len = scnprintf(&(buf[count]), PAGE_SIZE-count, " <  %+6lldns: %d\n", HIST_BIN_LOW(1), histogram[0]); count += len;
-  for (i = 1; i < hist_bin_num; i++) {
-    len = scnprintf(&(buf[count]), PAGE_SIZE-count, " >= %+6lldns: %d\n", HIST_BIN_LOW(i), histogram[i]); count += len;
-    if (count > PAGE_SIZE) return PAGE_SIZE;
+/**
+ * Accumulate the statistics block src into dst, both with the same bins
+ */
+static void lattest_stat_merge(struct lattest_stat *dst, const struct lattest_stat *src) {
+  int i;
+  if (src->min < dst->min) dst->min = src->min;
+  if (src->max > dst->max) dst->max = src->max;
+  dst->num   += src->num;
+  dst->sum   += src->sum;
+  ull128_add(&dst->sumsq, &src->sumsq);
+  dst->overruns += src->overruns;
+  if (src->overrun_max > dst->overrun_max) {
+    dst->overrun_max    = src->overrun_max;
+    dst->overrun_max_ns = src->overrun_max_ns;
+  }
+  for (i = 0; i < dst->hist_num; i++) {
+    dst->histogram[i] += src->histogram[i];
   }
-  return count;
 }
 
-static struct class  *s_pDeviceClass;
-static struct device *s_pDeviceObject;
-static DEVICE_ATTR(status,     S_IRUSR           | S_IRGRP           | S_IROTH          , show_status_cb,     NULL);
-static DEVICE_ATTR(period,     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_period_cb,     store_period_cb);
-static DEVICE_ATTR(control,              S_IWUSR           | S_IWGRP                    , NULL,               store_control_cb);
-static DEVICE_ATTR(config,     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_config_cb,     store_config_cb);
-static DEVICE_ATTR(statistics, S_IRUSR           | S_IRGRP           | S_IROTH          , show_statistics_cb, NULL);
-
-//////////////////////////////////////////////////////////////////////////////
-// Initialization & Finalization /////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
+/**
+ * Add a sample to the counters of a statistics block, but not to its histogram
+ */
+static inline void lattest_stat_count(struct lattest_stat *stat, long long value) {
+  // magnitude saturated to 32 bit (~4.3s), so its square fits into 64 bit and
+  // is a single 32x32->64 bit multiplication on ARM
+  u64 mag = abs(value);
+  u32 mag32 = (mag > U32_MAX) ? U32_MAX : mag;
 
-static int __init lattest_init(void) {
+  if (value < stat->min) stat->min = value;
+  if (value > stat->max) stat->max = value;
+  stat->num++;
+  stat->sum   += value;   // 10^10 samples of 1ms each are still far from overflowing
+  ull128_add_u64(&stat->sumsq, (u64)mag32 * mag32);
+}
 
-  int ret;
+/**
+ * Add a sample to a statistics block
+ *
+ * The last bin takes all samples above, by the bin count of stat itself and
+ * not of the configuration, so a sample can never land outside of the
+ * histogram it is written to.
+ */
+static inline void lattest_stat_add(struct lattest_stat *stat, long long value, long long hist_bin) {
+  lattest_stat_count(stat, value);
+  if (hist_bin >= stat->hist_num) hist_bin = stat->hist_num-1;
+  stat->histogram[hist_bin]++;
+}
 
-  printk(KERN_INFO "Initializing LatTest: Small kernel module to test the latency variance\n");
+/**
+ * Account missed expiries of a callback at now_ns
+ */
+static inline void lattest_stat_overrun(struct lattest_stat *stat, long long missed, long long now_ns) {
+  stat->overruns += missed;
+  if (missed > stat->overrun_max) {
+    stat->overrun_max    = missed;
+    stat->overrun_max_ns = now_ns;
+  }
+}
 
-#ifdef GPIO_LATTEST_TOGGLE
-  // GPIO
-  ret = gpio_request_one(GPIO_LATTEST_TOGGLE, GPIOF_OUT_INIT_LOW, "lattest");
-  if (ret) {
-    printk(KERN_ERR "Unable to request GPIOs: %d\n", ret);
-    return ret;
+/**
+ * Calculate mean, variance and standard deviation of a statistics block
+ */
+static void lattest_stat_calc(const struct lattest_stat *stat, long long *mean, long long *var, long long *stddev) {
+  struct ull128 sq;
+  struct ull128 var128;
+  if (stat->num > 0) {
+    *mean = div_ll(stat->sum, stat->num);   // replacing inline 64/64bit division
+    // StdDev = sqrt((stat_sumsq-(stat_sum^2)/stat_num)/stat_num), in 128 bit
+    sq = ull128_mul(abs(stat->sum), abs(stat->sum));
+    ull128_div_u64(&sq, stat->num);
+    var128 = stat->sumsq;
+    if (ull128_lt(&var128, &sq)) {
+      // only possible with saturated squares
+      *var = 0;
+    } else {
+      ull128_sub(&var128, &sq);
+      ull128_div_u64(&var128, stat->num);
+      *var = (var128.hi != 0 || var128.lo > LLONG_MAX) ? LLONG_MAX : var128.lo;
+    }
+    *stddev = isqrtu64(*var);
+  } else {
+    *mean = 0;
+    *var = 0;
+    *stddev = 0;
   }
-  gpio_lattest_value = 1;   // start with 0, ISR will set it to 1 at first call
-#endif // GPIO_LATTEST_TOGGLE
+}
 
-  // SysFS
-  s_pDeviceClass = class_create(THIS_MODULE, "LatTest");
-  BUG_ON(IS_ERR(s_pDeviceClass));
-  s_pDeviceObject = device_create(s_pDeviceClass, NULL, 0, NULL, "LatTest");
-  BUG_ON(IS_ERR(s_pDeviceObject));
-  ret = device_create_file(s_pDeviceObject, &dev_attr_status);
-  BUG_ON(ret < 0);
-  ret = device_create_file(s_pDeviceObject, &dev_attr_period);
-  BUG_ON(ret < 0);
-  ret = device_create_file(s_pDeviceObject, &dev_attr_control);
-  BUG_ON(ret < 0);
-  ret = device_create_file(s_pDeviceObject, &dev_attr_config);
-  BUG_ON(ret < 0);
-  ret = device_create_file(s_pDeviceObject, &dev_attr_statistics);
-  BUG_ON(ret < 0);
-  printk(KERN_INFO "  Registered sysfs attributes at /sys/class/LatTest/LatTest/\n");
+static const unsigned int lattest_percentile_ppm[LATTEST_PERCENTILE_NUM] = LATTEST_PERCENTILES_PPM;
+static const char * const lattest_percentile_names[LATTEST_PERCENTILE_NUM] = { "P50", "P99", "P99.9", "P99.99" };
 
-  // set defaults
-  runcount       = 0;     // 0: stopped
-  period_ms      = 10;    // ms
-  hist_bin_num   = 20;
-  hist_bin_width = 1000;  // ns
+/**
+ * Percentile ppm (in parts per million) of a statistics block from its histogram
+ *
+ * This is the upper bound of the bin that contains the percentile, i.e.,
+ * at least ppm of all samples are below or equal. It is limited to min and
+ * max, so the open-ended outer bins don't matter. The histogram is the
+ * reference for the number of samples, it might be one ahead of num.
+ */
+static long long lattest_stat_percentile(const struct lattest_inst *li, const struct lattest_stat *stat, long long (*bin_low)(const struct lattest_inst *, unsigned int), unsigned int ppm) {
+  u64 total = 0;
+  u64 target;
+  u64 cum = 0;
+  long long value = stat->max;
+  unsigned int i;
 
-  // timer
-  hrtimer_init(&my_hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-  my_hrtimer.function = &lattest_timer_function;
+  for (i = 0; i < stat->hist_num; i++) total += stat->histogram[i];
+  if (total == 0) return 0;
+  // no 64/64 bit division built in: target = ceil(total * ppm / 10^6), at least 1
+  target = div64_u64(total * ppm + 999999, 1000000);
+  if (target == 0) target = 1;
+  for (i = 0; i < stat->hist_num; i++) {
+    cum += stat->histogram[i];
+    if (cum >= target) {
+      if (i+1 < stat->hist_num) value = bin_low(li, i+1) - 1;
+      break;
+    }
+  }
+  if (value > stat->max) value = stat->max;
+  if (value < stat->min) value = stat->min;
+  return value;
+}
 
-  // A non 0 return means init_module failed; module can't be loaded. 
+/**
+ * Check whether the timer of any CPU is still running
+ */
+static int lattest_running(const struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    if (per_cpu_ptr(li->cpu_data, cpu)->runcount != 0) return 1;
+  }
   return 0;
 }
 
-static void __exit lattest_exit(void) {
-  int ret_cancel = 0;
-  while (hrtimer_callback_running(&my_hrtimer)) {
-    ret_cancel++;
+/**
+ * Cancel the timers of all CPUs
+ *
+ * After a "stop" the last callback might still be pending, this waits for it
+ * and for the wakeup thread and IPI it triggered before the timer state is
+ * changed.
+ */
+static void lattest_timers_cancel(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    hrtimer_cancel(&lc->timer);
+    while (READ_ONCE(lc->thr_pending)) msleep(1);
+    while (READ_ONCE(lc->ipi_pending)) msleep(1);
   }
-  if (ret_cancel != 0) {
-    printk(KERN_INFO " lattest Waited for hrtimer callback to finish (%d)\n", ret_cancel);
+}
+
+/**
+ * Free the IPI statistics blocks of a receiving CPU
+ */
+static void lattest_ipi_stat_free(struct lattest_stat *ipi) {
+  int src;
+  if (!ipi) return;
+  for (src = 0; src < nr_cpu_ids; src++) {
+    lattest_stat_free(&ipi[src]);
   }
-  if (hrtimer_active(&my_hrtimer) != 0) {
-    ret_cancel = hrtimer_cancel(&my_hrtimer);
-    printk(KERN_INFO " lattest active hrtimer cancelled: %d (%d)\n", ret_cancel, runcount);
+  kfree(ipi);
+}
+
+/**
+ * Free the IPI statistics of all CPUs
+ */
+static void lattest_ipi_free(struct lattest_inst *li) {
+  int cpu;
+  mutex_lock(&li->stat_mutex);
+  lattest_timers_cancel(li);   // the last IPIs might still be pending
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    lattest_ipi_stat_free(lc->ipi);
+    lc->ipi = NULL;
   }
-  if (hrtimer_is_queued(&my_hrtimer) != 0) {
-    ret_cancel = hrtimer_cancel(&my_hrtimer);
-    printk(KERN_INFO " lattest queued hrtimer cancelled: %d (%d)\n", ret_cancel, runcount);
+  mutex_unlock(&li->stat_mutex);
+}
+
+/**
+ * Free IPI statistics allocated by lattest_ipi_new(), or the old ones after
+ * lattest_ipi_swap()
+ */
+static void lattest_ipi_release(struct lattest_stat **new_ipi) {
+  int cpu;
+  if (!new_ipi) return;
+  for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+    lattest_ipi_stat_free(new_ipi[cpu]);
   }
+  kfree(new_ipi);
+}
 
-#ifdef GPIO_LATTEST_TOGGLE
-  // GPIO
-  gpio_set_value(GPIO_LATTEST_TOGGLE, 0);
-  gpio_free(GPIO_LATTEST_TOGGLE);
-#endif // GPIO_LATTEST_TOGGLE
-
-  device_remove_file(s_pDeviceObject, &dev_attr_status);
-  device_remove_file(s_pDeviceObject, &dev_attr_period);
-  device_remove_file(s_pDeviceObject, &dev_attr_control);
-  device_remove_file(s_pDeviceObject, &dev_attr_config);
-  device_remove_file(s_pDeviceObject, &dev_attr_statistics);
-  device_destroy(s_pDeviceClass, 0);
-  class_destroy(s_pDeviceClass);
+/**
+ * Allocate the IPI statistics of all pairs of CPUs with latency_bins bins
+ *
+ * These are nr_cpu_ids² blocks, so only done while IPIs are enabled. NULL
+ * if out of memory.
+ */
+static struct lattest_stat **lattest_ipi_new(unsigned int latency_bins) {
+  struct lattest_stat **new_ipi;
+  int cpu;
+  int src;
+  int ret = 0;
+
+  new_ipi = kcalloc(nr_cpu_ids, sizeof(*new_ipi), GFP_KERNEL);
+  if (!new_ipi) return NULL;
+  for_each_possible_cpu(cpu) {
+    new_ipi[cpu] = kcalloc(nr_cpu_ids, sizeof(*new_ipi[cpu]), GFP_KERNEL);
+    if (!new_ipi[cpu]) ret = -ENOMEM;
+    for (src = 0; ret == 0 && src < nr_cpu_ids; src++) {
+      ret = lattest_stat_alloc(&new_ipi[cpu][src], latency_bins);
+    }
+    if (ret < 0) {
+      lattest_ipi_release(new_ipi);
+      return NULL;
+    }
+  }
+  return new_ipi;
+}
+
+/**
+ * Replace the IPI statistics of all CPUs by new_ipi, which then holds the
+ * old ones
+ *
+ * Must be called with stat_mutex held and the timers cancelled.
+ */
+static void lattest_ipi_swap(struct lattest_inst *li, struct lattest_stat **new_ipi) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    swap(per_cpu_ptr(li->cpu_data, cpu)->ipi, new_ipi[cpu]);
+  }
+}
+
+/**
+ * Allocate the IPI statistics of all pairs of CPUs with the current
+ * histogram configuration and enable the IPIs
+ *
+ * -EBUSY if the configuration changed while they were allocated.
+ */
+static int lattest_ipi_alloc(struct lattest_inst *li) {
+  unsigned int latency_bins = lattest_latency_bins(li);
+  struct lattest_stat **new_ipi;
+  int ret = 0;
+
+  // allocate everything first, so nothing is lost on failure
+  new_ipi = lattest_ipi_new(latency_bins);
+  if (!new_ipi) return -ENOMEM;
+  mutex_lock(&li->stat_mutex);
+  if (lattest_running(li)) {
+    ret = -EINVAL;   // timer running
+  } else if (lattest_latency_bins(li) != latency_bins) {
+    ret = -EBUSY;    // changed by another writer meanwhile
+  } else {
+    lattest_timers_cancel(li);
+    lattest_ipi_swap(li, new_ipi);
+    li->ipi = true;
+  }
+  mutex_unlock(&li->stat_mutex);
+  // free the old statistics or the new ones on failure
+  lattest_ipi_release(new_ipi);
+  return ret;
+}
+
+/**
+ * Free histograms allocated by lattest_hist_new(), or the old ones after
+ * lattest_hist_swap()
+ */
+static void lattest_hist_release(struct lattest_stat *new_stat) {
+  int i;
+  if (!new_stat) return;
+  for (i = 0; i < 8*nr_cpu_ids+2; i++) {
+    lattest_stat_free(&new_stat[i]);
+  }
+  kfree(new_stat);
+}
+
+/**
+ * Allocate the histograms of all CPUs and of the loopback IRQ with the
+ * given bins
+ *
+ * 8 blocks per CPU, then 2 for the loopback IRQ. NULL if out of memory.
+ */
+static struct lattest_stat *lattest_hist_new(unsigned int jitter_bins, unsigned int latency_bins) {
+  struct lattest_stat *new_stat;
+  int cpu;
+  int ret = 0;
+
+  new_stat = kcalloc(8*nr_cpu_ids+2, sizeof(*new_stat), GFP_KERNEL);
+  if (!new_stat) return NULL;
+  ret = lattest_stat_alloc(&new_stat[8*nr_cpu_ids],   latency_bins);
+  if (ret == 0) ret = lattest_stat_alloc(&new_stat[8*nr_cpu_ids+1], latency_bins);
+  if (ret == 0) for_each_possible_cpu(cpu) {
+    ret = lattest_stat_alloc(&new_stat[8*cpu],   jitter_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+1], latency_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+2], latency_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+3], latency_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+4], jitter_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+5], latency_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+6], latency_bins);
+    if (ret < 0) break;
+    ret = lattest_stat_alloc(&new_stat[8*cpu+7], latency_bins);
+    if (ret < 0) break;
+  }
+  if (ret < 0) {
+    lattest_hist_release(new_stat);
+    return NULL;
+  }
+  return new_stat;
+}
+
+/**
+ * Replace the histograms of all CPUs and of the loopback IRQ by new_stat,
+ * which then holds the old ones
+ *
+ * Must be called with stat_mutex held and the timers cancelled.
+ */
+static void lattest_hist_swap(struct lattest_inst *li, struct lattest_stat *new_stat) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    swap(lc->stat,      new_stat[8*cpu]);
+    swap(lc->lat,       new_stat[8*cpu+1]);
+    swap(lc->thr,       new_stat[8*cpu+2]);
+    swap(lc->ovh,       new_stat[8*cpu+3]);
+    swap(lc->stat_last, new_stat[8*cpu+4]);
+    swap(lc->lat_last,  new_stat[8*cpu+5]);
+    swap(lc->thr_last,  new_stat[8*cpu+6]);
+    swap(lc->ovh_last,  new_stat[8*cpu+7]);
+  }
+  // the loopback belongs to the first instance
+  if (li->id == 0) {
+    if (lattest_irq >= 0) disable_irq(lattest_irq);   // waits for a running handler
+    swap(irq_stat,      new_stat[8*nr_cpu_ids]);
+    swap(irq_stat_last, new_stat[8*nr_cpu_ids+1]);
+    if (lattest_irq >= 0) enable_irq(lattest_irq);
+  }
+}
+
+/**
+ * Allocate the histograms of all CPUs for the initial configuration
+ */
+static int lattest_hist_alloc(struct lattest_inst *li) {
+  struct lattest_stat *new_stat;
+
+  new_stat = lattest_hist_new(lattest_jitter_bins(li), lattest_latency_bins(li));
+  if (!new_stat) return -ENOMEM;
+  mutex_lock(&li->stat_mutex);
+  lattest_hist_swap(li, new_stat);
+  mutex_unlock(&li->stat_mutex);
+  lattest_hist_release(new_stat);
+  return 0;
+}
+
+/**
+ * Change the histogram configuration and reallocate all histograms for it
+ *
+ * mode < 0 keeps the histogram mode, bin_num <= 0 keeps bin count, width
+ * and offset. The histograms are allocated first, then stat_mutex is held
+ * across the check that no timer runs, the update of the configuration and
+ * the swap, so neither the timers nor other writers ever see the new
+ * configuration with the old histograms. -EBUSY if another writer changed
+ * the configuration meanwhile. On failure nothing is changed.
+ */
+static int lattest_hist_config(struct lattest_inst *li, int mode, long long bin_num, long long bin_width, long long bin_offset) {
+  int old_mode = li->hist_mode;
+  long long old_num = li->hist_bin_num;
+  unsigned int jitter_bins  = lattest_jitter_bins_of( (mode < 0) ? old_mode : mode, (bin_num <= 0) ? old_num : bin_num);
+  unsigned int latency_bins = lattest_latency_bins_of((mode < 0) ? old_mode : mode, (bin_num <= 0) ? old_num : bin_num);
+  bool ipi = li->ipi;
+  struct lattest_stat *new_stat;
+  struct lattest_stat **new_ipi = NULL;
+  int ret = 0;
+
+  // allocate everything first, so nothing is lost on failure
+  new_stat = lattest_hist_new(jitter_bins, latency_bins);
+  if (!new_stat) return -ENOMEM;
+  // the IPI statistics must have the same bins
+  if (ipi) {
+    new_ipi = lattest_ipi_new(latency_bins);
+    if (!new_ipi) {
+      lattest_hist_release(new_stat);
+      return -ENOMEM;
+    }
+  }
+
+  mutex_lock(&li->stat_mutex);
+  if (lattest_running(li)) {
+    ret = -EINVAL;   // timer running
+  } else if (li->hist_mode != old_mode || li->hist_bin_num != old_num || li->ipi != ipi) {
+    ret = -EBUSY;    // changed by another writer meanwhile
+  } else {
+    // the last callbacks after a "stop" still use the old configuration
+    lattest_timers_cancel(li);
+    if (mode >= 0) li->hist_mode = mode;
+    if (bin_num > 0) {
+      li->hist_bin_num    = bin_num;
+      li->hist_bin_width  = bin_width;
+      li->hist_bin_offset = bin_offset;
+    }
+    lattest_hist_swap(li, new_stat);
+    if (ipi) lattest_ipi_swap(li, new_ipi);
+  }
+  mutex_unlock(&li->stat_mutex);
+  // free the old histograms or the new ones on failure
+  lattest_hist_release(new_stat);
+  lattest_ipi_release(new_ipi);
+  return ret;
+}
+
+/**
+ * Free the histograms of all CPUs and of the loopback IRQ
+ */
+static void lattest_hist_free(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->stat);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->lat);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->thr);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->stat_last);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->lat_last);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->thr_last);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->ovh);
+    lattest_stat_free(&per_cpu_ptr(li->cpu_data, cpu)->ovh_last);
+  }
+  if (li->id == 0) {
+    lattest_stat_free(&irq_stat);
+    lattest_stat_free(&irq_stat_last);
+  }
+}
+
+/**
+ * Get a consistent copy of the counters of a CPU's statistics
+ *
+ * With last == 0 these are the live statistics, which the timer might update
+ * concurrently, otherwise the ones of the interval before the last reset.
+ * The copies share the histograms with the originals, the bins are read
+ * without retry, so they might contain a sample more than the counters. On
+ * 32 bit CPUs a bin read right while its lower half wraps can be off by
+ * 2^32 in that one read.
+ */
+static void lattest_stat_get(struct lattest_cpu *lc, int last, struct lattest_stat *stat, struct lattest_stat *lat, struct lattest_stat *thr, struct lattest_stat *ovh) {
+  unsigned int seq;
+  if (last) {
+    // not touched by the timer
+    *stat = lc->stat_last;
+    *lat  = lc->lat_last;
+    *thr  = lc->thr_last;
+    *ovh  = lc->ovh_last;
+    return;
+  }
+  do {
+    seq = read_seqcount_begin(&lc->seq);
+    *stat = lc->stat;
+    *lat  = lc->lat;
+    *thr  = lc->thr;
+    *ovh  = lc->ovh;
+  } while (read_seqcount_retry(&lc->seq, seq));
+}
+
+/**
+ * Merge the statistics of all CPUs, see lattest_stat_get()
+ *
+ * Must be called with stat_mutex held.
+ */
+static void lattest_stat_merge_all(struct lattest_inst *li, int last, struct lattest_stat *stat, struct lattest_stat *lat, struct lattest_stat *thr, struct lattest_stat *ovh) {
+  struct lattest_stat cpu_stat;
+  struct lattest_stat cpu_lat;
+  struct lattest_stat cpu_thr;
+  struct lattest_stat cpu_ovh;
+  int cpu;
+  for_each_lattest_cpu(li, cpu) {
+    lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), last, &cpu_stat, &cpu_lat, &cpu_thr, &cpu_ovh);
+    lattest_stat_merge(stat, &cpu_stat);
+    lattest_stat_merge(lat,  &cpu_lat);
+    lattest_stat_merge(thr,  &cpu_thr);
+    lattest_stat_merge(ovh,  &cpu_ovh);
+  }
+}
+
+/**
+ * Get a consistent copy of the counters of the loopback IRQ statistics, see
+ * lattest_stat_get(). The loopback belongs to the first instance, all others
+ * get empty statistics without a histogram.
+ */
+static void lattest_irq_stat_get(const struct lattest_inst *li, int last, struct lattest_stat *stat) {
+  unsigned int seq;
+  if (li->id != 0) {
+    stat->histogram = NULL;
+    stat->hist_num  = 0;
+    lattest_stat_reset(stat);
+    return;
+  }
+  if (last) {
+    *stat = irq_stat_last;
+    return;
+  }
+  do {
+    seq = read_seqcount_begin(&irq_seq);
+    *stat = irq_stat;
+  } while (read_seqcount_retry(&irq_seq, seq));
+}
+
+/**
+ * Get a consistent copy of the counters of the IPI statistics from CPU src
+ * to the CPU of lc, see lattest_stat_get()
+ */
+static void lattest_ipi_stat_get(struct lattest_cpu *lc, int src, struct lattest_stat *stat) {
+  unsigned int seq;
+  do {
+    seq = read_seqcount_begin(&lc->ipi_seq);
+    *stat = lc->ipi[src];
+  } while (read_seqcount_retry(&lc->ipi_seq, seq));
+}
+
+/**
+ * Get a consistent copy of the latency of an idle bucket of a CPU
+ *
+ * The copy has no histogram.
+ */
+static void lattest_idle_stat_get(struct lattest_cpu *lc, int bucket, struct lattest_stat *stat) {
+  unsigned int seq;
+  do {
+    seq = read_seqcount_begin(&lc->seq);
+    *stat = lc->idle[bucket];
+  } while (read_seqcount_retry(&lc->seq, seq));
+}
+
+/**
+ * Start a new statistics interval on all CPUs without stopping the timers
+ *
+ * The statistics since the previous reset are moved to stat_last/lat_last/thr_last/ovh_last.
+ * Running timers do that themselves at their next expiry (the swap is a
+ * handful of stores), this only waits for it. stat_mutex is dropped while
+ * waiting, so readers meanwhile may see CPUs which already started the new
+ * interval next to ones which didn't yet.
+ */
+static void lattest_stat_interval_reset(struct lattest_inst *li) {
+  int cpu;
+
+  mutex_lock(&li->reset_mutex);
+  mutex_lock(&li->stat_mutex);
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    // discard the older interval, the timer doesn't touch it
+    lattest_stat_reset(&lc->stat_last);
+    lattest_stat_reset(&lc->lat_last);
+    lattest_stat_reset(&lc->thr_last);
+    lattest_stat_reset(&lc->ovh_last);
+    smp_store_release(&lc->swap_req, 1);
+  }
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    while (smp_load_acquire(&lc->swap_req)) {
+      if (!hrtimer_active(&lc->timer) && !READ_ONCE(lc->thr_pending)) {
+        // timer is stopped and can't be started while we hold stat_mutex,
+        // the thread only writes after a wakeup by the timer
+        swap(lc->stat, lc->stat_last);
+        swap(lc->lat,  lc->lat_last);
+        swap(lc->thr,  lc->thr_last);
+        swap(lc->ovh,  lc->ovh_last);
+        lc->swap_req = 0;
+        break;
+      }
+      // the next expiry can be up to a period away, don't block the
+      // readers and control meanwhile
+      mutex_unlock(&li->stat_mutex);
+      msleep(1);
+      mutex_lock(&li->stat_mutex);
+    }
+  }
+  if (li->id == 0 && lattest_irq >= 0) {
+    disable_irq(lattest_irq);   // waits for a running handler
+    lattest_stat_reset(&irq_stat_last);
+    swap(irq_stat, irq_stat_last);
+    enable_irq(lattest_irq);
+  }
+  mutex_unlock(&li->stat_mutex);
+  mutex_unlock(&li->reset_mutex);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// GPIO //////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Set the GPIO, either directly in the SoC registers or via gpiolib
+ */
+static inline void lattest_gpio_set(int value) {
+  if (gpio_regs) {
+    writel_relaxed(gpio_mask, value ? gpio_set_reg : gpio_clr_reg);
+  } else {
+    gpio_set_value(gpio_lattest, value);
+  }
+}
+
+/**
+ * Map the GPIO registers for gpio_direct
+ *
+ * The GPIO is still requested via gpiolib, which also configures it as
+ * output, only the toggling bypasses it.
+ */
+static int lattest_gpio_map(void) {
+  struct device_node *np;
+
+  if (gpio_lattest >= BCM2835_GPIO_NUM) return -EINVAL;
+  if (gpio_phys) {
+    gpio_regs = ioremap(gpio_phys, BCM2835_GPIO_SIZE);
+  } else {
+    np = of_find_compatible_node(NULL, NULL, "brcm,bcm2711-gpio");
+    if (!np) np = of_find_compatible_node(NULL, NULL, "brcm,bcm2835-gpio");
+    if (!np) return -ENODEV;
+    gpio_regs = of_iomap(np, 0);
+    of_node_put(np);
+  }
+  if (!gpio_regs) return -ENOMEM;
+  gpio_mask    = 1 << (gpio_lattest % 32);
+  gpio_set_reg = gpio_regs + BCM2835_GPSET0 + 4*(gpio_lattest / 32);
+  gpio_clr_reg = gpio_regs + BCM2835_GPCLR0 + 4*(gpio_lattest / 32);
+  return 0;
+}
+
+/**
+ * Interrupt handler of the loopback GPIO input
+ *
+ * Every edge of the toggled GPIO arrives here, the latency is measured from
+ * the time taken right before the edge was written. The handler of an IRQ
+ * never runs concurrently with itself, so it is the only writer of irq_stat.
+ * dev_id is the instance owning the GPIOs, its histogram setup is used.
+ */
+static irqreturn_t lattest_gpio_irq_handler(int irq, void *dev_id) {
+  const struct lattest_inst *li = dev_id;
+  long long irq_ns = ktime_get_ns() - READ_ONCE(gpio_toggle_ns);
+
+  write_seqcount_begin(&irq_seq);
+  lattest_stat_add(&irq_stat, irq_ns, lattest_latency_bin(li, irq_ns));
+  write_seqcount_end(&irq_seq);
+  return IRQ_HANDLED;
+}
+
+/**
+ * Request the loopback GPIO input and its interrupt
+ *
+ * The handler runs in hard interrupt context also on PREEMPT_RT, otherwise
+ * the latency would include the wakeup of the IRQ thread.
+ */
+static int lattest_gpio_irq_request(struct lattest_inst *li) {
+  int ret;
+
+  ret = gpio_request_one(gpio_lattest_irq, GPIOF_IN, "lattest_irq");
+  if (ret) return ret;
+  ret = gpio_to_irq(gpio_lattest_irq);
+  if (ret < 0) goto err;
+  lattest_irq = ret;
+  ret = request_irq(lattest_irq, lattest_gpio_irq_handler,
+    IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING | IRQF_NO_THREAD, "lattest", li);
+  if (ret) {
+    lattest_irq = -1;
+    goto err;
+  }
+  return 0;
+
+err:
+  gpio_free(gpio_lattest_irq);
+  return ret;
+}
+
+/**
+ * Free the loopback GPIO interrupt and input
+ */
+static void lattest_gpio_irq_free(struct lattest_inst *li) {
+  if (lattest_irq < 0) return;
+  free_irq(lattest_irq, li);
+  lattest_irq = -1;
+  gpio_free(gpio_lattest_irq);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Raw Sample Ring Buffer ////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Append a sample to the ring buffer of the current CPU
+ *
+ * Only called by the timer of this CPU, so this is the single producer. If
+ * the consumer didn't keep up, the sample is dropped.
+ *
+ * The header is writable by userspace, so the only value read from it is
+ * tail. A bogus tail can only overwrite unread samples, the slot is always
+ * within the ring.
+ */
+static inline void lattest_ring_put(struct lattest_cpu *lc, long long now_ns, long long lat_ns, int overrun, int idle_state, unsigned int freq_khz) {
+  struct lattest_ring_header *ring = lc->ring;
+  struct lattest_sample *sample;
+  u32 head;
+
+  if (!ring) return;
+  head = lc->ring_head;
+  if (head - smp_load_acquire(&ring->tail) > lc->ring_mask) {
+    lc->ring_dropped++;
+    WRITE_ONCE(ring->dropped, lc->ring_dropped);
+    return;
+  }
+  sample = &lc->ring_data[head & lc->ring_mask];
+  sample->timestamp_ns = now_ns;
+  sample->latency_ns   = lat_ns;
+  sample->cpu          = smp_processor_id();
+  sample->overrun      = overrun;
+  sample->idle_state   = idle_state;
+  sample->freq_khz     = freq_khz;
+  // publish the sample only after it is completely written
+  lc->ring_head = head + 1;
+  smp_store_release(&ring->head, lc->ring_head);
+}
+
+/**
+ * Free the ring buffers of all CPUs
+ *
+ * The timers must be stopped and the rings must not be mapped.
+ */
+static void lattest_ring_free(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    // the last callback after a "stop" might still be pending
+    hrtimer_cancel(&lc->timer);
+    vfree(lc->ring);
+    lc->ring = NULL;
+    lc->ring_data = NULL;
+  }
+  li->ring_size = 0;
+}
+
+/**
+ * Allocate the ring buffers of all CPUs with 'size' samples each
+ */
+static int lattest_ring_alloc(struct lattest_inst *li, unsigned int size) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    struct lattest_ring_header *ring = vmalloc_user(LATTEST_RING_MAP_SIZE(size, PAGE_SIZE));   // zeroed
+    if (!ring) {
+      lattest_ring_free(li);
+      return -ENOMEM;
+    }
+    ring->version     = LATTEST_RING_VERSION;
+    ring->size        = size;
+    ring->data_offset = PAGE_SIZE;
+    lc->ring_data    = (struct lattest_sample *)((char *)ring + PAGE_SIZE);
+    lc->ring_mask    = size - 1;
+    lc->ring_head    = 0;
+    lc->ring_dropped = 0;
+    lc->ring = ring;
+  }
+  li->ring_size = size;
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Rolling Windows ///////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Add a sample to the current window of the current CPU
+ *
+ * Only called by the timer of this CPU. A finished window is rolled over
+ * into the ring with a release of win_head, so readers don't need a lock.
+ * Windows are aligned to multiples of window_ns on the timer's clock, so
+ * they have the same start times on all CPUs.
+ */
+static inline void lattest_window_add(struct lattest_cpu *lc, long long now_ns, long long lat_ns, int missed) {
+  const struct lattest_inst *li = lc->li;
+  struct lattest_window *w = &lc->win_cur;
+  long long start_ns;
+
+  if (unlikely(now_ns >= lc->win_end_ns)) {
+    if (lc->win_end_ns != 0 && w->num > 0) {
+      lc->win[lc->win_head & (WINDOW_NUM-1)] = *w;
+      smp_store_release(&lc->win_head, lc->win_head + 1);
+    }
+    start_ns = lc->win_end_ns;
+    if (start_ns == 0 || now_ns - start_ns >= li->window_ns) {
+      // first window or empty windows in between: one division to align
+      start_ns = div_ll(now_ns, li->window_ns) * li->window_ns;
+    }
+    w->start_ns = start_ns;
+    w->num      = 0;
+    w->min      = LLONG_MAX;
+    w->max      = LLONG_MIN;
+    w->sum      = 0;
+    w->overruns = 0;
+    w->cpu      = smp_processor_id();
+    lc->win_end_ns = start_ns + li->window_ns;
+  }
+  w->num++;
+  if (lat_ns < w->min) w->min = lat_ns;
+  if (lat_ns > w->max) w->max = lat_ns;
+  w->sum      += lat_ns;
+  w->overruns += missed;
+}
+
+/**
+ * Copy the newest max finished windows of a CPU to dst, oldest first
+ *
+ * Windows overwritten by the timer while copying are dropped. Returns the
+ * number of windows copied.
+ */
+static unsigned int lattest_window_get(struct lattest_cpu *lc, struct lattest_window *dst, unsigned int max) {
+  unsigned int head = smp_load_acquire(&lc->win_head);
+  unsigned int num  = min3(head, max, (unsigned int)WINDOW_NUM);
+  unsigned int first = head - num;
+  unsigned int drop;
+  unsigned int i;
+
+  for (i = 0; i < num; i++) {
+    dst[i] = lc->win[(first + i) & (WINDOW_NUM-1)];
+  }
+  smp_rmb();
+  // window i is overwritten once the head passed i+WINDOW_NUM-1, i.e., is being written
+  drop = READ_ONCE(lc->win_head) - first;
+  if (drop >= WINDOW_NUM) {
+    drop = min(drop - WINDOW_NUM + 1, num);
+    memmove(dst, dst + drop, (num - drop)*sizeof(*dst));
+    num -= drop;
+  }
+  return num;
+}
+
+/**
+ * Offset of CLOCK_REALTIME against the timer's clock
+ */
+static long long lattest_realtime_offset(struct lattest_inst *li) {
+  struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpumask_first(&li->cpus));
+  return ktime_get_real_ns() - ktime_to_ns(hrtimer_cb_get_time(&lc->timer));
+}
+
+/**
+ * Free the window rings of all CPUs
+ */
+static void lattest_window_free(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    kvfree(lc->win);
+    lc->win = NULL;
+  }
+}
+
+/**
+ * Allocate the window rings of all CPUs, once at init
+ */
+static int lattest_window_alloc(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    lc->win = kvcalloc(WINDOW_NUM, sizeof(lc->win[0]), GFP_KERNEL);
+    if (!lc->win) {
+      lattest_window_free(li);
+      return -ENOMEM;
+    }
+  }
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Load Generators ///////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Self-IPI of LOAD_IPI, the interrupt itself is the load
+ */
+static void lattest_load_ipi_fn(struct irq_work *work) {
+}
+
+/**
+ * Background load thread, bound to its CPU
+ *
+ * It runs with normal priority during the measurement of the first
+ * instance, the load follows only that one. It is stopped by "stop" or
+ * after the end of the run, see lattest_run_end().
+ */
+static int lattest_load_fn(void *data) {
+  struct lattest_load *ll = data;
+  unsigned long flags;
+  size_t i;
+
+  while (!kthread_should_stop()) {
+    switch (ll->type) {
+      case LOAD_CACHE:
+        // one access per cacheline, every one is a miss
+        for (i = 0; i < LOAD_BUF_SIZE; i += L1_CACHE_BYTES) {
+          ((volatile u8 *)ll->buf)[i]++;
+        }
+        break;
+      case LOAD_MEMBW:
+        memcpy(ll->buf, (char *)ll->buf + LOAD_BUF_SIZE/2, LOAD_BUF_SIZE/2);
+        break;
+      case LOAD_IPI:
+        for (i = 0; i < LOAD_IPI_BURST; i++) {
+          irq_work_queue(&ll->work);
+          irq_work_sync(&ll->work);
+        }
+        break;
+      case LOAD_SPINLOCK:
+        raw_spin_lock_irqsave(&load_lock, flags);
+        udelay(LOAD_SPIN_HOLD_US);
+        raw_spin_unlock_irqrestore(&load_lock, flags);
+        break;
+    }
+    ll->loops++;
+    cond_resched();
+  }
+  return 0;
+}
+
+/**
+ * Stop the load threads of all CPUs
+ */
+static void lattest_load_stop(void) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_load *ll = &per_cpu(lattest_load_data, cpu);
+    if (!ll->thread) continue;
+    kthread_stop(ll->thread);
+    ll->thread = NULL;
+    vfree(ll->buf);
+    ll->buf = NULL;
+  }
+}
+
+/**
+ * Start a load thread of type on each online CPU of cpus
+ *
+ * On failure no thread is left.
+ */
+static int lattest_load_start(const struct cpumask *cpus, int type) {
+  struct task_struct *thread;
+  int cpu;
+  int ret = 0;
+
+  if (type == LOAD_NONE) return 0;
+  for_each_cpu_and(cpu, cpus, cpu_online_mask) {
+    struct lattest_load *ll = &per_cpu(lattest_load_data, cpu);
+    ll->type  = type;
+    ll->loops = 0;
+    ll->work  = IRQ_WORK_INIT_HARD(lattest_load_ipi_fn);
+    if (type == LOAD_CACHE || type == LOAD_MEMBW) {
+      ll->buf = vzalloc(LOAD_BUF_SIZE);
+      if (!ll->buf) {
+        ret = -ENOMEM;
+        goto err;
+      }
+    }
+    thread = kthread_create_on_cpu(lattest_load_fn, ll, cpu, "lattest_load/%u");
+    if (IS_ERR(thread)) {
+      ret = PTR_ERR(thread);
+      vfree(ll->buf);
+      ll->buf = NULL;
+      goto err;
+    }
+    ll->thread = thread;
+    wake_up_process(thread);
+  }
+  return 0;
+
+err:
+  printk(KERN_ERR "lattest: Unable to start the load thread on CPU%d: %d\n", cpu, ret);
+  lattest_load_stop();
+  return ret;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Idle States and Frequency /////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Probe of the cpu_idle tracepoint, remembers the state the CPU enters
+ *
+ * The idle loop traces the index of the cpuidle state (1 without a cpuidle
+ * driver) before entering it and PWR_EVENT_EXIT after it woke up.
+ */
+static void lattest_cpu_idle_probe(void *data, unsigned int state, unsigned int cpu) {
+  if (state != PWR_EVENT_EXIT) per_cpu(lattest_idle_state, cpu) = state;
+}
+
+/**
+ * Probe of the cpu_frequency tracepoint, traced by cpufreq for each CPU of
+ * a policy after a frequency change, also for fast switching
+ */
+static void lattest_cpu_frequency_probe(void *data, unsigned int freq_khz, unsigned int cpu) {
+  per_cpu(lattest_freq_khz, cpu) = freq_khz;
+  per_cpu(lattest_freq_changes, cpu)++;
+}
+
+/**
+ * Idle state the current CPU was woken up from by the running interrupt
+ *
+ * The CPU was idle if the interrupt hit the idle task, i.e., before it
+ * went back to the scheduler.
+ */
+static inline int lattest_idle_state_now(void) {
+  int state;
+  if (!is_idle_task(current)) return LATTEST_IDLE_BUSY;
+  state = __this_cpu_read(lattest_idle_state);
+  if (state < 0 || state >= CPUIDLE_STATE_MAX) return LATTEST_IDLE_UNKNOWN;
+  return state;
+}
+
+/**
+ * Name of an idle bucket for the statistics: "busy", "idle" for an unknown
+ * state, or the name of the cpuidle state
+ */
+static void lattest_idle_name(int bucket, char *name, size_t size) {
+  struct cpuidle_driver *drv = cpuidle_get_driver();
+  int state = bucket + LATTEST_IDLE_UNKNOWN;
+
+  if (state == LATTEST_IDLE_BUSY) {
+    strscpy(name, "busy", size);
+  } else if (state == LATTEST_IDLE_UNKNOWN) {
+    strscpy(name, "idle", size);
+  } else if (drv && state < drv->state_count) {
+    snprintf(name, size, "%s", drv->states[state].name);
+  } else {
+    snprintf(name, size, "state%d", state);
+  }
+}
+
+/**
+ * Register the probes of the idle and frequency tracepoints
+ *
+ * Without tracepoints in the kernel, the samples have no idle state and no
+ * frequency.
+ */
+static void lattest_idle_probes_register(void) {
+  int cpu;
+  int ret;
+
+  for_each_possible_cpu(cpu) {
+    per_cpu(lattest_idle_state, cpu) = LATTEST_IDLE_UNKNOWN;
+  }
+  ret = register_trace_cpu_idle(lattest_cpu_idle_probe, NULL);
+  if (ret) printk(KERN_WARNING "lattest: Unable to trace the idle states: %d\n", ret);
+  lattest_idle_traced = (ret == 0);
+  ret = register_trace_cpu_frequency(lattest_cpu_frequency_probe, NULL);
+  if (ret) printk(KERN_WARNING "lattest: Unable to trace the CPU frequencies: %d\n", ret);
+  lattest_freq_traced = (ret == 0);
+}
+
+/**
+ * Unregister the probes and wait until none runs anymore
+ */
+static void lattest_idle_probes_unregister(void) {
+  if (lattest_idle_traced) unregister_trace_cpu_idle(lattest_cpu_idle_probe, NULL);
+  if (lattest_freq_traced) unregister_trace_cpu_frequency(lattest_cpu_frequency_probe, NULL);
+  lattest_idle_traced = false;
+  lattest_freq_traced = false;
+  tracepoint_synchronize_unregister();
+}
+
+/**
+ * Read the current frequency of the CPUs of a run, the probe only sees
+ * later changes
+ */
+static void lattest_freq_init(const struct cpumask *cpus) {
+  int cpu;
+  for_each_cpu(cpu, cpus) {
+    per_cpu(lattest_freq_khz, cpu) = cpufreq_quick_get(cpu);   // 0 without cpufreq
+  }
+}
+
+/**
+ * Drop the CPU latency limit
+ *
+ * Must be called with stat_mutex held.
+ */
+static void lattest_qos_remove(struct lattest_inst *li) {
+  if (cpu_latency_qos_request_active(&li->qos_req)) cpu_latency_qos_remove_request(&li->qos_req);
+}
+
+/**
+ * Request the configured CPU latency limit for a run, replacing the one of
+ * the previous run
+ *
+ * Must be called with stat_mutex held.
+ */
+static void lattest_qos_request(struct lattest_inst *li) {
+  int qos_us = li->idle_qos_us;
+
+  if (qos_us < 0) {
+    lattest_qos_remove(li);
+  } else if (cpu_latency_qos_request_active(&li->qos_req)) {
+    cpu_latency_qos_update_request(&li->qos_req, qos_us);
+  } else {
+    cpu_latency_qos_add_request(&li->qos_req, qos_us);
+  }
+}
+
+/**
+ * Release what a run holds after its end, unless a new run has started:
+ * the CPU latency limit and, for the first instance, the load threads
+ */
+static void lattest_run_end(struct lattest_inst *li) {
+  mutex_lock(&li->stat_mutex);
+  if (!lattest_running(li)) {
+    lattest_qos_remove(li);
+    if (li->id == 0) lattest_load_stop();
+  }
+  mutex_unlock(&li->stat_mutex);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Streaming /////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+static const struct genl_multicast_group lattest_genl_mcgrps[] = {
+  { .name = LATTEST_GENL_MCGRP },
+};
+
+// only multicasts, no commands from userspace
+static struct genl_family lattest_genl_family = {
+  .name     = LATTEST_GENL_NAME,
+  .version  = LATTEST_GENL_VERSION,
+  .maxattr  = LATTEST_NLA_MAX,
+  .module   = THIS_MODULE,
+  .mcgrps   = lattest_genl_mcgrps,
+  .n_mcgrps = ARRAY_SIZE(lattest_genl_mcgrps),
+};
+
+/**
+ * Interval of the stream worker: one window, but not shorter than
+ * STREAM_INTERVAL_MIN_MS
+ */
+static unsigned long lattest_stream_interval(const struct lattest_inst *li) {
+  long long ms = div_ll(li->window_ns, NSEC_PER_MSEC);
+  return msecs_to_jiffies(max_t(long long, ms, STREAM_INTERVAL_MIN_MS));
+}
+
+/**
+ * Skip the windows which were overwritten before they could be sent
+ *
+ * Like in lattest_window_get(), window i is being overwritten once the head
+ * passed i+WINDOW_NUM-1.
+ */
+static void lattest_stream_skip_lost(struct lattest_inst *li, struct lattest_cpu *lc, unsigned int head) {
+  if (head - lc->stream_tail >= WINDOW_NUM) {
+    li->stream_lost += head - lc->stream_tail - WINDOW_NUM + 1;
+    lc->stream_tail  = head - WINDOW_NUM + 1;
+  }
+}
+
+/**
+ * Append the unsent windows of a CPU to the message, as long as they fit
+ *
+ * Returns -EMSGSIZE if the message is full, the remaining windows are sent
+ * with the next one.
+ */
+static int lattest_stream_put_cpu(struct lattest_inst *li, struct lattest_cpu *lc, struct sk_buff *skb, unsigned int *num) {
+  unsigned int head = smp_load_acquire(&lc->win_head);
+  struct lattest_window w;
+
+  lattest_stream_skip_lost(li, lc, head);
+  while (lc->stream_tail != head) {
+    // keep room for LATTEST_NLA_LOST at the end
+    if (skb_tailroom(skb) < nla_total_size(sizeof(w)) + nla_total_size(sizeof(u32))) return -EMSGSIZE;
+    w = lc->win[lc->stream_tail & (WINDOW_NUM-1)];
+    smp_rmb();
+    if (READ_ONCE(lc->win_head) - lc->stream_tail >= WINDOW_NUM) {
+      // overwritten while copying
+      head = smp_load_acquire(&lc->win_head);
+      lattest_stream_skip_lost(li, lc, head);
+      continue;
+    }
+    nla_put(skb, LATTEST_NLA_WINDOW, sizeof(w), &w);   // fits, see above
+    lc->stream_tail++;
+    (*num)++;
+  }
+  return 0;
+}
+
+/**
+ * Send one message with the unsent windows of all CPUs
+ *
+ * Returns -EMSGSIZE if not all of them fitted. Without listeners, the
+ * windows are just skipped.
+ */
+static int lattest_stream_send(struct lattest_inst *li) {
+  struct sk_buff *skb;
+  void *hdr;
+  unsigned int lost = li->stream_lost;
+  unsigned int num = 0;
+  int ret = 0;
+  int cpu;
+
+  if (!genl_has_listeners(&lattest_genl_family, &init_net, 0)) {
+    for_each_possible_cpu(cpu) {
+      struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+      lc->stream_tail = smp_load_acquire(&lc->win_head);
+    }
+    return 0;
+  }
+
+  skb = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+  if (!skb) return -ENOMEM;
+  hdr = genlmsg_put(skb, 0, 0, &lattest_genl_family, 0, LATTEST_CMD_WINDOWS);
+  if (!hdr ||
+      nla_put_u32(skb, LATTEST_NLA_INSTANCE, li->id) ||
+      nla_put_s64(skb, LATTEST_NLA_WINDOW_NS, li->window_ns, LATTEST_NLA_PAD) ||
+      nla_put_s64(skb, LATTEST_NLA_REALTIME_OFFSET, lattest_realtime_offset(li), LATTEST_NLA_PAD)) {
+    nlmsg_free(skb);
+    return -ENOMEM;
+  }
+  for_each_lattest_cpu(li, cpu) {
+    ret = lattest_stream_put_cpu(li, per_cpu_ptr(li->cpu_data, cpu), skb, &num);
+    if (ret < 0) break;
+  }
+  if (num == 0 && li->stream_lost == lost) {
+    nlmsg_free(skb);
+    return 0;
+  }
+  nla_put_u32(skb, LATTEST_NLA_LOST, li->stream_lost);   // room was kept
+  genlmsg_end(skb, hdr);
+  genlmsg_multicast(&lattest_genl_family, skb, 0, 0, GFP_KERNEL);   // fails only without listeners
+  return ret;
+}
+
+/**
+ * Periodically send the finished windows, as long as streaming is enabled
+ *
+ * Runs on an unbound workqueue, so it can be kept away from the measured
+ * CPUs with /sys/devices/virtual/workqueue/cpumask.
+ */
+static void lattest_stream_work(struct work_struct *work) {
+  struct lattest_inst *li = container_of(to_delayed_work(work), struct lattest_inst, stream_work);
+  int ret;
+
+  mutex_lock(&li->stat_mutex);   // against the reset of the window rings at the start
+  do {
+    ret = lattest_stream_send(li);
+  } while (ret == -EMSGSIZE);
+  mutex_unlock(&li->stat_mutex);
+  if (li->stream) queue_delayed_work(system_unbound_wq, &li->stream_work, lattest_stream_interval(li));
+}
+
+/**
+ * Start streaming with the windows finished from now on
+ */
+static void lattest_stream_start(struct lattest_inst *li) {
+  int cpu;
+  mutex_lock(&li->stat_mutex);
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    lc->stream_tail = smp_load_acquire(&lc->win_head);
+  }
+  li->stream_lost = 0;
+  li->stream = true;
+  mutex_unlock(&li->stat_mutex);
+  queue_delayed_work(system_unbound_wq, &li->stream_work, lattest_stream_interval(li));
+}
+
+/**
+ * Stop streaming and wait for the worker
+ */
+static void lattest_stream_stop(struct lattest_inst *li) {
+  li->stream = false;
+  cancel_delayed_work_sync(&li->stream_work);
+}
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Raise an event, callable from the timers and threads
+ *
+ * sysfs_notify() can sleep, so it is deferred to a work item. Events raised
+ * until it runs are merged into one notification.
+ */
+static void lattest_event_raise(struct lattest_inst *li, int event) {
+  if (!test_and_set_bit(event, &li->event_pending)) schedule_work(&li->event_work);
+}
+
+/**
+ * Notify the pollers of event, and of status at the end of a run
+ */
+static void lattest_event_work(struct work_struct *work) {
+  struct lattest_inst *li = container_of(work, struct lattest_inst, event_work);
+  unsigned long events = xchg(&li->event_pending, 0);
+
+  if (!events) return;
+  li->event_last = events;
+  li->event_num++;
+  sysfs_notify(&li->dev->kobj, NULL, "event");
+  if (events & BIT(EVENT_DONE)) {
+    lattest_run_end(li);
+    sysfs_notify(&li->dev->kobj, NULL, "status");
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Outlier Log ///////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Rescan the interrupts per IRQ of a CPU and keep the device IRQs with the
+ * most interrupts since the last scan in att, if given
+ *
+ * The walk is only done at outliers and at the start, never at the other
+ * callbacks, so the IRQs are those since the previous outlier of this CPU
+ * (or the start). It only covers att_irq_list, not all nr_irqs, so its
+ * time in the callback is bounded by the IRQs in use.
+ */
+static void lattest_attribution_scan(struct lattest_cpu *lc, int cpu, struct lattest_attribution *att) {
+  const struct lattest_inst *li = lc->li;
+  unsigned int irq;
+  unsigned int num;
+  unsigned int delta;
+  unsigned int j;
+  int i;
+
+  for (j = 0; j < li->att_irq_num; j++) {
+    irq   = li->att_irq_list[j];
+    num   = kstat_irqs_cpu(irq, cpu);
+    delta = num - lc->att_irqs[j];
+    lc->att_irqs[j] = num;
+    if (!att || delta == 0) continue;
+    // insertion into the short list, sorted by the number of interrupts
+    for (i = OUTLIER_IRQS; i > 0 && att->irq_num[i-1] < delta; i--) {
+      if (i < OUTLIER_IRQS) {
+        att->irq[i]     = att->irq[i-1];
+        att->irq_num[i] = att->irq_num[i-1];
+      }
+    }
+    if (i < OUTLIER_IRQS) {
+      att->irq[i]     = irq;
+      att->irq_num[i] = delta;
+    }
+  }
+}
+
+/**
+ * Collect the device IRQs with a handler into att_irq_list, at the start
+ *
+ * Per-CPU IRQs like the timer and IPIs are left out. IRQs requested later
+ * aren't scanned before the next start. Must be called with the timers
+ * cancelled, before lattest_attribution_reset().
+ */
+static void lattest_attribution_irqs(struct lattest_inst *li) {
+  unsigned int irq;
+  unsigned int num = 0;
+  for (irq = 0; irq < min_t(unsigned int, nr_irqs, li->att_irq_max); irq++) {
+    if (!irq_has_action(irq) || irq_is_percpu_devid(irq)) continue;
+    li->att_irq_list[num++] = irq;
+  }
+  li->att_irq_num = num;
+}
+
+/**
+ * Take the interrupt counts of a CPU as the reference, at the start
+ */
+static void lattest_attribution_reset(struct lattest_cpu *lc, int cpu) {
+  int i;
+  lc->att_hardirqs = kstat_cpu_irqs_sum(cpu);
+  for (i = 0; i < NR_SOFTIRQS; i++) {
+    lc->att_softirqs[i] = kstat_softirqs_cpu(i, cpu);
+  }
+  lattest_attribution_scan(lc, cpu, NULL);
+  lc->att_pid = 0;
+  lc->att_comm[0] = '\0';
+}
+
+/**
+ * What happened on the current CPU since the last callback of its timer
+ *
+ * Called by the timer with the interrupted task, and by the thread with
+ * interrupts disabled and task NULL for the task interrupted by the
+ * callback which woke it.
+ */
+static void lattest_attribution_get(struct lattest_cpu *lc, struct lattest_attribution *att, struct task_struct *task) {
+  int cpu = smp_processor_id();
+  int i;
+
+  memset(att, 0, sizeof(*att));
+  att->hardirqs = kstat_cpu_irqs_sum(cpu) - lc->att_hardirqs;
+  for (i = 0; i < NR_SOFTIRQS; i++) {
+    att->softirqs[i] = kstat_softirqs_cpu(i, cpu) - lc->att_softirqs[i];
+  }
+  lattest_attribution_scan(lc, cpu, att);
+  if (task) {
+    att->pid = task_pid_nr(task);
+    memcpy(att->comm, task->comm, sizeof(att->comm));
+  } else {
+    att->pid = lc->att_pid;
+    memcpy(att->comm, lc->att_comm, sizeof(att->comm));
+  }
+}
+
+/**
+ * Take the interrupt and softirq totals at this callback as the reference
+ * for the next one, called by the timer while the outlier log is enabled
+ *
+ * Only the per-CPU totals are read, the per-IRQ counts are left to the
+ * outliers.
+ */
+static void lattest_attribution_tick(struct lattest_cpu *lc) {
+  int cpu = smp_processor_id();
+  int i;
+
+  lc->att_hardirqs = kstat_cpu_irqs_sum(cpu);
+  for (i = 0; i < NR_SOFTIRQS; i++) {
+    lc->att_softirqs[i] = kstat_softirqs_cpu(i, cpu);
+  }
+  if (lc->thread) {
+    lc->att_pid = task_pid_nr(current);
+    memcpy(lc->att_comm, current->comm, sizeof(lc->att_comm));
+  }
+}
+
+/**
+ * Free the IRQ list and the per-IRQ counts of all CPUs
+ */
+static void lattest_attribution_free(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    kfree(lc->att_irqs);
+    lc->att_irqs = NULL;
+  }
+  kfree(li->att_irq_list);
+  li->att_irq_list = NULL;
+  li->att_irq_num  = 0;
+  li->att_irq_max  = 0;
+}
+
+/**
+ * Allocate the IRQ list and the per-IRQ counts of all CPUs, once at init
+ *
+ * IRQs above the nr_irqs of this time aren't scanned.
+ */
+static int lattest_attribution_alloc(struct lattest_inst *li) {
+  int cpu;
+  li->att_irq_list = kcalloc(nr_irqs, sizeof(li->att_irq_list[0]), GFP_KERNEL);
+  if (!li->att_irq_list) return -ENOMEM;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    lc->att_irqs = kcalloc(nr_irqs, sizeof(lc->att_irqs[0]), GFP_KERNEL);
+    if (!lc->att_irqs) {
+      lattest_attribution_free(li);
+      return -ENOMEM;
+    }
+  }
+  li->att_irq_max = nr_irqs;
+  return 0;
+}
+
+/**
+ * Log an outlier with its attribution, called by the timers and threads
+ * right at the detection
+ *
+ * With breaktrace the first outlier stops ftrace, so its ring buffer keeps
+ * the trace leading up to the outlier (like cyclictest --breaktrace).
+ */
+static void lattest_outlier_add(struct lattest_inst *li, int source, long long now_ns, long long latency_ns, const struct lattest_attribution *att) {
+  struct lattest_outlier *o;
+  unsigned long flags;
+
+  if (li->breaktrace && !li->breaktrace_done) {
+    tracing_off();
+    li->breaktrace_done = true;
+  }
+  raw_spin_lock_irqsave(&li->outlier_lock, flags);
+  o = &li->outlier_log[li->outlier_num & (OUTLIER_LOG_SIZE-1)];
+  o->timestamp_ns = now_ns;
+  o->latency_ns   = latency_ns;
+  o->cpu          = smp_processor_id();
+  o->source       = source;
+  o->att          = *att;
+  li->outlier_num++;
+  raw_spin_unlock_irqrestore(&li->outlier_lock, flags);
+  lattest_event_raise(li, EVENT_OUTLIER);
+}
+
+/**
+ * Clear the outlier log, at the start
+ */
+static void lattest_outlier_clear(struct lattest_inst *li) {
+  unsigned long flags;
+  raw_spin_lock_irqsave(&li->outlier_lock, flags);
+  li->outlier_num = 0;
+  raw_spin_unlock_irqrestore(&li->outlier_lock, flags);
+  li->breaktrace_done = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Wakeup Thread /////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Per-CPU SCHED_FIFO thread, woken by the timer of its CPU
+ *
+ * The latency from the programmed expiry until the thread runs includes the
+ * timer interrupt latency plus the scheduler wakeup and context switch, i.e.,
+ * what a real-time task in userspace would see.
+ */
+static int lattest_thread_fn(void *data) {
+  struct lattest_cpu *lc = data;
+  struct lattest_inst *li = lc->li;
+  long long thr_ns;
+  unsigned long flags;
+  struct lattest_attribution att;
+  bool outlier;
+
+  for (;;) {
+    set_current_state(TASK_INTERRUPTIBLE);
+    if (kthread_should_stop()) break;
+    if (!smp_load_acquire(&lc->thr_pending)) {
+      schedule();
+      continue;
+    }
+    __set_current_state(TASK_RUNNING);
+
+    thr_ns = ktime_to_ns(hrtimer_cb_get_time(&lc->timer)) - lc->thr_expires_ns;
+    // the timer of this CPU is the other writer, it must not interrupt us
+    local_irq_save(flags);
+    write_seqcount_begin(&lc->seq);
+    lattest_stat_add(&lc->thr, thr_ns, lattest_latency_bin(li, thr_ns));
+    write_seqcount_end(&lc->seq);
+    // the timer must not update the reference of the attribution meanwhile
+    outlier = (li->outlier_threshold_ns > 0 && thr_ns > li->outlier_threshold_ns);
+    if (outlier) lattest_attribution_get(lc, &att, NULL);
+    local_irq_restore(flags);
+    if (outlier) {
+      lattest_outlier_add(li, OUTLIER_THREAD, lc->thr_expires_ns + thr_ns, thr_ns, &att);
+    }
+    smp_store_release(&lc->thr_pending, 0);
+  }
+  __set_current_state(TASK_RUNNING);
+  return 0;
+}
+
+/**
+ * Stop the wakeup threads of all CPUs
+ *
+ * The timers must be stopped.
+ */
+static void lattest_threads_stop(struct lattest_inst *li) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    if (!lc->thread) continue;
+    kthread_stop(lc->thread);
+    lc->thread = NULL;
+    lc->thr_pending = 0;
+  }
+}
+
+/**
+ * Start a wakeup thread with SCHED_FIFO priority prio on each CPU of cpus
+ *
+ * The timers must be stopped. On failure no thread is left.
+ */
+static int lattest_threads_start(struct lattest_inst *li, const struct cpumask *cpus, int prio) {
+  struct sched_attr attr = {
+    .size           = sizeof(attr),
+    .sched_policy   = SCHED_FIFO,
+    .sched_priority = prio,
+  };
+  struct task_struct *thread;
+  int cpu;
+  int ret;
+
+  for_each_cpu(cpu, cpus) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    // kthread_create_on_cpu() binds the thread to cpu
+    thread = kthread_create_on_cpu(lattest_thread_fn, lc, cpu, "lattest/%u");
+    if (IS_ERR(thread)) {
+      ret = PTR_ERR(thread);
+      goto err;
+    }
+    // sched_setscheduler() isn't exported anymore, sched_set_fifo() has a fixed priority
+    ret = sched_setattr_nocheck(thread, &attr);
+    if (ret < 0) {
+      kthread_stop(thread);
+      goto err;
+    }
+    lc->thr_pending = 0;
+    lc->thread = thread;
+    wake_up_process(thread);
+  }
+  return 0;
+
+err:
+  printk(KERN_ERR "lattest: Unable to start the wakeup thread on CPU%d: %d\n", cpu, ret);
+  lattest_threads_stop(li);
+  return ret;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Cross-CPU IPI /////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * IPI handler on the target CPU, records the delivery latency of the pair
+ *
+ * ipi has its own seqcount with this handler as its only writer, a soft
+ * timer runs with interrupts enabled and this could nest into its section
+ * of lc->seq.
+ */
+static void lattest_ipi_func(void *info) {
+  struct lattest_cpu *src = info;
+  struct lattest_inst *li = src->li;
+  struct lattest_cpu *lc = this_cpu_ptr(li->cpu_data);
+  long long ipi_ns = ktime_get_ns() - src->ipi_sent_ns;
+
+  write_seqcount_begin(&lc->ipi_seq);
+  lattest_stat_add(&lc->ipi[src->ipi_src], ipi_ns, lattest_latency_bin(li, ipi_ns));
+  write_seqcount_end(&lc->ipi_seq);
+  smp_store_release(&src->ipi_pending, 0);
+}
+
+/**
+ * Send an IPI from the timer to the next other CPU of the run, so that all
+ * pairs of CPUs are measured in turn
+ *
+ * An IPI still pending from the previous expiry is counted as missed, its
+ * csd can't be reused yet.
+ */
+static void lattest_ipi_send(struct lattest_inst *li, struct lattest_cpu *lc) {
+  int self = smp_processor_id();
+  int cpu = lc->ipi_target;
+
+  if (READ_ONCE(lc->ipi_pending)) {
+    lc->ipi_missed++;
+    return;
+  }
+  do {
+    cpu = cpumask_next(cpu, &li->run_cpus);
+    if (cpu >= nr_cpu_ids) cpu = cpumask_first(&li->run_cpus);
+  } while (cpu == self);   // the run has at least two CPUs
+  lc->ipi_target  = cpu;
+  lc->ipi_src     = self;
+  lc->ipi_pending = 1;
+  lc->ipi_sent_ns = ktime_get_ns();
+  // the queueing of the csd orders the stores above before the handler
+  if (smp_call_function_single_async(cpu, &lc->ipi_csd) < 0) {
+    lc->ipi_missed++;
+    lc->ipi_pending = 0;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Timestamps ////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Read the ARM generic timer counter, 0 if there is none
+ *
+ * arch_timer_read_counter() includes the workarounds for unstable counters.
+ */
+static inline u64 lattest_counter_read(void) {
+#ifdef CONFIG_ARM_ARCH_TIMER
+  return arch_timer_read_counter();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Frequency of the ARM generic timer counter in Hz, 0 if there is none
+ */
+static u32 lattest_counter_rate(void) {
+#ifdef CONFIG_ARM_ARCH_TIMER
+  return arch_timer_get_rate();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Read the counter and the monotonic clock as close together as possible
+ */
+static void lattest_counter_pair(u64 *cyc, long long *ns) {
+  unsigned long flags;
+  local_irq_save(flags);
+  *cyc = lattest_counter_read();
+  *ns  = ktime_get_ns();
+  local_irq_restore(flags);
+}
+
+/**
+ * Measure the rate of the timer's clock against the counter over
+ * TS_CALIBRATE_MS, the nominal rate from ts_rate is off by the NTP
+ * correction
+ *
+ * All clocks of the timers run at the rate of CLOCK_MONOTONIC. Sleeps, the
+ * timers must not run yet. Falls back to the nominal ts_mult.
+ */
+static void lattest_counter_measure(struct lattest_inst *li) {
+  u64 cyc0, cyc1;
+  long long ns0, ns1;
+
+  clocks_calc_mult_shift(&li->ts_mult, &li->ts_shift, li->ts_rate, NSEC_PER_SEC, 4);
+  lattest_counter_pair(&cyc0, &ns0);
+  msleep(TS_CALIBRATE_MS);
+  lattest_counter_pair(&cyc1, &ns1);
+  // a sleep much longer than asked for would overflow the shift
+  if (cyc1 > cyc0 && cyc1 - cyc0 < li->ts_rate) li->ts_mult = div64_u64((u64)(ns1 - ns0) << li->ts_shift, cyc1 - cyc0);
+}
+
+/**
+ * Calibrate the counter timestamps of the current CPU against the timer's
+ * clock, called with interrupts disabled
+ */
+static void lattest_counter_calibrate(struct lattest_cpu *lc) {
+  lc->ts_mult = lc->li->ts_mult;
+  lc->ts_cyc0 = lattest_counter_read();
+  lc->ts_ns0  = ktime_to_ns(hrtimer_cb_get_time(&lc->timer));
+}
+
+/**
+ * Raw timestamp for the execution time of the timer callback, counter cycles
+ * or ns depending on the timestamp source, see lattest_overhead_ns()
+ */
+static inline u64 lattest_overhead_stamp(const struct lattest_inst *li) {
+  return (li->timestamp == TS_COUNTER) ? lattest_counter_read() : ktime_get_ns();
+}
+
+/**
+ * Time in ns since the raw timestamp start, see lattest_overhead_stamp()
+ */
+static inline long long lattest_overhead_ns(const struct lattest_cpu *lc, u64 start) {
+  const struct lattest_inst *li = lc->li;
+  u64 end = lattest_overhead_stamp(li);
+  if (li->timestamp == TS_COUNTER) return (long long)mul_u64_u32_shr(end - start, lc->ts_mult, li->ts_shift);
+  return end - start;
+}
+
+/**
+ * Current time on the timer's clock from the counter
+ *
+ * The counter is free running while the timer's clock is steered by NTP, so
+ * about once a second the reference is taken again and ts_mult is set to
+ * the rate of the timer's clock measured since the last one. This keeps the
+ * offset between both below the error of the rate over one second.
+ */
+static inline long long lattest_counter_ns(struct lattest_cpu *lc) {
+  const struct lattest_inst *li = lc->li;
+  u64 cyc   = lattest_counter_read();
+  u64 delta = cyc - lc->ts_cyc0;
+  long long ns;
+
+  if (likely(delta < li->ts_rate)) {
+    return lc->ts_ns0 + (long long)mul_u64_u32_shr(delta, lc->ts_mult, li->ts_shift);
+  }
+  ns = ktime_to_ns(hrtimer_cb_get_time(&lc->timer));
+  // only measure the rate over about a second, the shift would overflow otherwise
+  if (delta < 2*(u64)li->ts_rate) lc->ts_mult = div64_u64((u64)(ns - lc->ts_ns0) << li->ts_shift, delta);
+  lc->ts_cyc0 = cyc;
+  lc->ts_ns0  = ns;
+  return ns;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Timer Function ////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+static enum hrtimer_restart lattest_timer_function(struct hrtimer *timer) {
+  struct lattest_cpu *lc = container_of(timer, struct lattest_cpu, timer);
+  struct lattest_inst *li = lc->li;
+  ktime_t now_kt;
+  long long now_ns;
+  long long diff_ns = 0;   // jitter, 0 at the first callback
+  int idle_state = lattest_idle_state_now();
+  unsigned int freq_khz = __this_cpu_read(lattest_freq_khz);
+  long long lat_ns;
+  long long expires_ns;
+  long long ovh_ns;
+  int ret_overrun;
+  struct lattest_attribution att;
+  u64 entry = lattest_overhead_stamp(li);
+
+  // only one CPU toggles the GPIO, otherwise the edges would be meaningless
+  if (gpio_lattest >= 0 && smp_processor_id() == li->gpio_cpu) {
+    if (lattest_irq >= 0) {
+      // reference for the loopback IRQ, must be visible before the edge
+      gpio_toggle_ns = ktime_get_ns();
+      gpio_toggles++;
+      wmb();
+    }
+    lattest_gpio_set(gpio_lattest_value);
+    gpio_lattest_value = !gpio_lattest_value;
+  }
+
+  if (li->timestamp == TS_COUNTER) {
+    now_ns    = lattest_counter_ns(lc);
+    now_kt    = ns_to_ktime(now_ns);
+  } else {
+    now_kt    = hrtimer_cb_get_time(timer);
+    now_ns    = ktime_to_ns(now_kt);
+  }
+  // wakeup latency against the expiry we got woken up for, i.e., before forwarding
+  expires_ns  = hrtimer_get_expires_ns(timer);
+  lat_ns      = now_ns - expires_ns;
+  if (lc->thread) {
+    // the thread measures from the same expiry as we do
+    if (READ_ONCE(lc->thr_pending)) {
+      lc->thr_missed++;
+    } else {
+      lc->thr_expires_ns = expires_ns;
+      smp_store_release(&lc->thr_pending, 1);
+      wake_up_process(lc->thread);
+    }
+  }
+  if (li->ipi) lattest_ipi_send(li, lc);
+  // with counter timestamps now_kt may be slightly behind the timer's clock,
+  // forwarding against it could leave the expiry in the past
+  if (li->timestamp == TS_COUNTER) now_kt = hrtimer_cb_get_time(timer);
+  if (li->timer_mode & HRTIMER_MODE_REL) {
+    // relative: the next expiry is a period after this callback, so latencies
+    // accumulate like with a relative nanosleep() in a loop, a latency of
+    // more than a period counts as missed periods
+    hrtimer_set_expires(timer, ktime_add(now_kt, li->period_kt));
+    ret_overrun = 1;
+    if (unlikely(lat_ns >= ktime_to_ns(li->period_kt))) ret_overrun += div_ll(lat_ns, ktime_to_ns(li->period_kt));
+  } else {
+    // absolute: stay on the grid of the first expiry
+    ret_overrun = hrtimer_forward(timer, now_kt, li->period_kt);
+  }
+  if (unlikely(ret_overrun < 1)) ret_overrun = 1;   // not before the expiry, nothing missed
+
+  // statistics, readers retry if they overlap with this
+  // soft timers on PREEMPT_RT run preemptible, but the writer must not be
+  // preempted by a reader on the same CPU
+  preempt_disable();
+  write_seqcount_begin(&lc->seq);
+  if (unlikely(lc->swap_req)) {
+    // start a new interval, see lattest_stat_interval_reset(li)
+    swap(lc->stat, lc->stat_last);
+    swap(lc->lat,  lc->lat_last);
+    swap(lc->thr,  lc->thr_last);
+    swap(lc->ovh,  lc->ovh_last);
+    smp_store_release(&lc->swap_req, 0);
+  }
+  lattest_stat_add(&lc->lat, lat_ns, lattest_latency_bin(li, lat_ns));
+  lattest_stat_count(&lc->idle[IDLE_BUCKET(idle_state)], lat_ns);
+  // hrtimer_forward() returns 1 if no expiry was missed
+  if (unlikely(ret_overrun > 1)) lattest_stat_overrun(&lc->lat, ret_overrun - 1, now_ns);
+  if (lc->last_now_ns != 0) {
+    diff_ns     = now_ns - lc->last_now_ns;
+    // statistics
+    diff_ns = diff_ns - ktime_to_ns(li->period_kt);   // reuse variable
+
+    lattest_stat_add(&lc->stat, diff_ns, lattest_jitter_bin(li, diff_ns));
+  }
+  write_seqcount_end(&lc->seq);
+  preempt_enable();
+  if (li->outlier_threshold_ns > 0) {
+    if (unlikely(lat_ns > li->outlier_threshold_ns)) {
+      lattest_attribution_get(lc, &att, current);
+      lattest_outlier_add(li, OUTLIER_TIMER, now_ns, lat_ns, &att);
+    }
+    lattest_attribution_tick(lc);
+  }
+  lc->last_now_ns = now_ns;
+  if (li->window_ns > 0) lattest_window_add(lc, now_ns, lat_ns, ret_overrun - 1);
+  lattest_ring_put(lc, now_ns, lat_ns, ret_overrun - 1, idle_state, freq_khz);
+  trace_lattest_sample(li->id, now_ns, lat_ns, diff_ns, ret_overrun - 1, idle_state, freq_khz);
+  if (unlikely(ret_overrun > 1)) trace_lattest_overrun(li->id, now_ns, ret_overrun - 1);
+
+  // own execution time up to here, i.e., all of the above but recording it
+  ovh_ns = lattest_overhead_ns(lc, entry);
+  preempt_disable();
+  write_seqcount_begin(&lc->seq);
+  lattest_stat_add(&lc->ovh, ovh_ns, lattest_latency_bin(li, ovh_ns));
+  write_seqcount_end(&lc->seq);
+  preempt_enable();
+
+  if (lc->runcount > 0) {
+    // decrement counter
+    lc->runcount--;
+    return HRTIMER_RESTART;
+  } else if (lc->runcount == 0) {
+    // finished, don't restart the timer, the last one ends the run
+    if (atomic_dec_and_test(&li->timers_active)) {
+      trace_lattest_stop(li->id, !li->stopped);
+      lattest_event_raise(li, EVENT_DONE);
+    }
+    return HRTIMER_NORESTART;
+  } else /* if (lc->runcount < 0) */ {
+    // run infinitely
+    return HRTIMER_RESTART;
+  }
+}
+
+/**
+ * Start the timer of the current CPU, called via on_each_cpu_mask() so that
+ * the pinned timer is enqueued on the CPU it belongs to
+ *
+ * With absolute expiry times the first one is one period from now on the
+ * timer's clock, hrtimer_forward() keeps all following expiries on the same
+ * grid. Either way the programmed expiry is the reference for the wakeup
+ * latency. info is the instance.
+ */
+static void lattest_start_cpu(void *info) {
+  struct lattest_inst *li = info;
+  struct lattest_cpu *lc = this_cpu_ptr(li->cpu_data);
+  if (li->timestamp == TS_COUNTER) lattest_counter_calibrate(lc);
+  if (li->timer_mode & HRTIMER_MODE_REL) {
+    hrtimer_start(&lc->timer, li->period_kt, li->timer_mode);
+  } else {
+    hrtimer_start(&lc->timer, ktime_add(hrtimer_cb_get_time(&lc->timer), li->period_kt), li->timer_mode);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// SysFS /////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ *   .../status ...... (r) query current status: inactive/running, period, resolution, ...
+ *   .../event ....... (r) last notification, pollable
+ *   .../period ...... (rw) set/get period in ms
+ *   .../period_ns ... (rw) set/get period in ns
+ *   .../control ..... (w) start (with number of periods) / stop / reset statistics
+ *   .../config ...... (rw) configure statistics: number, width and offset of histogram bins
+ *   .../hist_mode ... (rw) set/get histogram mode: "linear" or "log"
+ *   .../cpus ........ (rw) set/get list of CPUs to run a timer on
+ *   .../timer_mode .. (rw) set/get hrtimer mode
+ *   .../clock ....... (rw) set/get hrtimer clock
+ *   .../timestamp ... (rw) set/get timestamp source of the timer callbacks
+ *   .../thread_prio . (rw) set/get SCHED_FIFO priority of the wakeup threads
+ *   .../load ........ (rw) set/get background load type
+ *   .../threshold_ns  (rw) set/get latency threshold of the outlier log
+ *   .../breaktrace .. (rw) set/get whether the first outlier calls tracing_off()
+ *   .../outliers .... (r) outlier log
+ *   .../window_ms ... (rw) set/get length of the rolling windows
+ *   .../windows ..... (r) newest rolling window summaries
+ *   .../windows_bin . (r) all rolling window summaries
+ *   .../load_cpus ... (rw) set/get list of CPUs to run a load thread on
+ *   .../statistics .. (r) statistics: min, max, mean, stddev, histogram
+ *   .../ringbuffer .. (rw) set/get number of raw samples per CPU ring buffer, 0 to disable
+ *   .../statistics_bin (r) binary statistics snapshot
+ *   .../statistics_last (r) statistics of the interval before the last "reset"
+ *   .../statistics_last_bin (r) binary statistics snapshot of that interval
+ */
+
+/**
+ * Name of a timer mode
+ */
+static const char *lattest_timer_mode_str(int mode) {
+  static const char * const names[] = {
+    "abs unpinned default", "rel unpinned default", "abs pinned default", "rel pinned default",
+    "abs unpinned soft",    "rel unpinned soft",    "abs pinned soft",    "rel pinned soft",
+    "abs unpinned hard",    "rel unpinned hard",    "abs pinned hard",    "rel pinned hard",
+  };
+  if (mode < 0 || mode >= ARRAY_SIZE(names)) return "invalid";
+  return names[mode];
+}
+
+/**
+ * Name of a clock
+ */
+static const char *lattest_clock_str(clockid_t clock) {
+  switch (clock) {
+    case CLOCK_MONOTONIC: return "monotonic";
+    case CLOCK_TAI:       return "tai";
+    case CLOCK_BOOTTIME:  return "boottime";
+    default:              return "invalid";
+  }
+}
+
+/**
+ * Query current status: inactive/running, period, resolution, ...
+ */
+static ssize_t show_status_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  ssize_t count = 0;
+  int len;
+  int cpu;
+  struct lattest_stat stat;
+  struct lattest_stat lat;
+  struct lattest_stat thr;
+  struct lattest_stat ovh;
+  int running = lattest_running(li);
+
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "HZ: %d\nJiffie Period: %d ms\nHR timer resolution: %d ns\nLatTest period: %lld ns\nCPUs: %*pbl\n",
+    HZ, 1000/HZ, hrtimer_resolution, ktime_to_ns(li->period_kt), cpumask_pr_args(&li->cpus)); count += len;
+  if (li->timestamp == TS_COUNTER) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Timestamps: counter, %u Hz, %u ns resolution\n",
+      li->ts_rate, DIV_ROUND_UP(NSEC_PER_SEC, li->ts_rate)); count += len;
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Timestamps: ktime, %d ns resolution\n", hrtimer_resolution); count += len;
+  }
+  for_each_lattest_cpu(li, cpu) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d RunCount: %d\n", cpu, per_cpu_ptr(li->cpu_data, cpu)->runcount); count += len;
+  }
+  // overruns of the current interval
+  mutex_lock(&li->stat_mutex);
+  for_each_lattest_cpu(li, cpu) {
+    lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), 0, &stat, &lat, &thr, &ovh);
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d Overruns: %lld, max %lld at %lldns\n",
+      cpu, lat.overruns, lat.overrun_max, lat.overrun_max_ns); count += len;
+  }
+  mutex_unlock(&li->stat_mutex);
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Timer mode: %s\nTimer clock: %s\n",
+    lattest_timer_mode_str(li->timer_mode), lattest_clock_str(li->timer_clock)); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Expiries: %s\n", ((li->timer_mode & HRTIMER_MODE_REL) ?
+    "a period after each callback, overruns are full periods of latency" :
+    "on the grid of the first expiry, overruns are skipped grid points")); count += len;
+  if (li->thread_prio > 0) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Wakeup threads: SCHED_FIFO priority %d\n", li->thread_prio); count += len;
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Wakeup threads: disabled\n"); count += len;
+  }
+  for_each_lattest_cpu(li, cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    if (!lc->thread) continue;
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d Wakeup thread: pid %d missed %lld\n",
+      cpu, task_pid_nr(lc->thread), lc->thr_missed); count += len;
+  }
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "IPIs: %s\n", (li->ipi ? "enabled" : "disabled")); count += len;
+  if (li->ipi) {
+    for_each_lattest_cpu(li, cpu) {
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d IPIs: missed %lld\n",
+        cpu, per_cpu_ptr(li->cpu_data, cpu)->ipi_missed); count += len;
+    }
+  }
+  if (li->idle_qos_us >= 0) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Idle QoS: %d us%s\n", li->idle_qos_us,
+      (cpu_latency_qos_request_active(&li->qos_req) ? ", requested" : "")); count += len;
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Idle QoS: disabled\n"); count += len;
+  }
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Idle states: %s\n", (lattest_idle_traced ? "traced" : "unknown")); count += len;
+  if (lattest_freq_traced) {
+    for_each_lattest_cpu(li, cpu) {
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d Frequency: %u kHz, %u changes\n",
+        cpu, per_cpu(lattest_freq_khz, cpu), per_cpu(lattest_freq_changes, cpu)); count += len;
+    }
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Frequency: unknown\n"); count += len;
+  }
+  if (li->outlier_threshold_ns > 0) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Outliers: %lld above %lldns%s\n", li->outlier_num, li->outlier_threshold_ns,
+      (li->breaktrace ? (li->breaktrace_done ? ", tracing stopped" : ", breaktrace armed") : "")); count += len;
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Outliers: disabled\n"); count += len;
+  }
+  if (li->stream) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Stream: enabled, %u windows lost\n", li->stream_lost); count += len;
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Stream: disabled\n"); count += len;
+  }
+  // the GPIOs and the load belong to the first instance
+  if (li->id == 0) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "GPIO: %d%s\n", gpio_lattest,
+      ((gpio_lattest < 0) ? " (disabled)" : (gpio_regs ? " (direct register access)" : " (gpiolib)"))); count += len;
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Load: %s on CPUs %*pbl\n",
+      lattest_load_names[load_type], cpumask_pr_args(&load_cpus)); count += len;
+    for_each_possible_cpu(cpu) {
+      struct lattest_load *ll = &per_cpu(lattest_load_data, cpu);
+      if (!ll->thread) continue;
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d Load: %s, %llu loops\n",
+        cpu, lattest_load_names[ll->type], ll->loops); count += len;
+    }
+    if (lattest_irq >= 0) {
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, "GPIO loopback: input %d, IRQ %d, %lld edges\n",
+        gpio_lattest_irq, lattest_irq, gpio_toggles); count += len;
+    } else {
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, "GPIO loopback: disabled\n"); count += len;
+    }
+  } else {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "GPIO, load, GPIO loopback: see LatTest\n"); count += len;
+  }
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Ring buffer: %u samples per CPU, %lu bytes per CPU mapping\n",
+    li->ring_size, (li->ring_size ? (unsigned long)LATTEST_RING_MAP_SIZE(li->ring_size, PAGE_SIZE) : 0)); count += len;
+  for_each_lattest_cpu(li, cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    if (!lc->ring) continue;
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d Ring buffer: head %u tail %u dropped %u\n",
+      cpu, READ_ONCE(lc->ring_head), READ_ONCE(lc->ring->tail), READ_ONCE(lc->ring_dropped)); count += len;
+  }
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Status: %s\n", (running ? "running" : "stopped")); count += len;
+  return count;
+}
+
+/**
+ * Query period in ms, rounded down for periods with fractional ms
+ */
+static ssize_t show_period_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%lld\n", ktime_to_ms(li->period_kt));
+}
+
+/**
+ * Set period in ms
+ *
+ * Max. 1 second allowed
+ */
+static ssize_t store_period_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  unsigned int new_period;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtouint(buf, 10, &new_period) < 0) return -EINVAL;
+  // max. 1 second allowed
+  if (new_period> 1000) return -EINVAL;
+  if (new_period == 0) return -EINVAL;
+
+  li->period_kt = ms_to_ktime(new_period);
+  printk(KERN_INFO "lattest: Setting period to %u ms", new_period);
+  return count;
+}
+
+/**
+ * Query period in ns
+ */
+static ssize_t show_period_ns_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%lld\n", ktime_to_ns(li->period_kt));
+}
+
+/**
+ * Set period in ns
+ *
+ * Allowed range is PERIOD_NS_MIN to PERIOD_NS_MAX.
+ */
+static ssize_t store_period_ns_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  unsigned int new_period;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtouint(buf, 10, &new_period) < 0) return -EINVAL;
+  if (new_period < PERIOD_NS_MIN || new_period > PERIOD_NS_MAX) return -EINVAL;
+
+  li->period_kt = ns_to_ktime(new_period);
+  printk(KERN_INFO "lattest: Setting period to %u ns", new_period);
+  return count;
+}
+
+/**
+ * Start (with number of periods or infinite) / stop / reset statistics
+ *
+ * "infinite"
+ * nnn
+ * "stop"
+ * "reset": start a new statistics interval without stopping the timers, the
+ *          previous one is reported by statistics_last and statistics_last_bin
+ */
+static ssize_t store_control_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  int new_runcount;
+  struct cpumask start_cpus;
+  int cpu;
+  int src;
+  int bucket;
+  int ret;
+
+  if (strncmp(buf, "stop", min((size_t)4, count)) == 0) {
+    // stop the timers
+    printk(KERN_INFO "lattest: Stopping the timer.");
+    // the last timer reports the end of the run
+    if (lattest_running(li)) {
+      li->stopped = true;
+      smp_wmb();   // before the timers see runcount 0
+    }
+    for_each_possible_cpu(cpu) {
+      per_cpu_ptr(li->cpu_data, cpu)->runcount = 0;
+    }
+    mutex_lock(&li->stat_mutex);
+    if (li->id == 0) lattest_load_stop();
+    lattest_qos_remove(li);
+    mutex_unlock(&li->stat_mutex);
+    return count;
+  } else if (strncmp(buf, "reset", min((size_t)5, count)) == 0) {
+    lattest_stat_interval_reset(li);
+    return count;
+  } else if (strncmp(buf, "infinite", min((size_t)8, count)) == 0) {
+    if (lattest_running(li)) return -EINVAL;   // timer already running
+    // run infinitely
+    new_runcount = -1;
+    printk(KERN_INFO "lattest: Starting the timer to run infinite times on CPUs %*pbl.", cpumask_pr_args(&li->cpus));
+  } else {
+    if (lattest_running(li)) return -EINVAL;   // timer already running
+    // run a given number of times
+    if (kstrtoint(buf, 10, &new_runcount) < 0) return -EINVAL;
+    if (new_runcount <= 0) return -EINVAL;
+    printk(KERN_INFO "lattest: Starting the timer to run %d times on CPUs %*pbl.", new_runcount, cpumask_pr_args(&li->cpus));
+  }
+  // CPUs might have gone offline since they were selected
+  cpumask_and(&start_cpus, &li->cpus, cpu_online_mask);
+  if (cpumask_empty(&start_cpus)) return -ENODEV;
+  if (li->ipi && cpumask_weight(&start_cpus) < 2) return -EINVAL;   // IPIs need a second CPU
+  // the GPIO and the load belong to the first instance
+  li->gpio_cpu = (li->id == 0) ? cpumask_first(&start_cpus) : -1;
+
+  // prepare for timers
+  mutex_lock(&li->stat_mutex);
+  // the last callbacks after a "stop" might still be pending
+  lattest_timers_cancel(li);
+  // without their last callback the previous run didn't report its end yet
+  if (atomic_xchg(&li->timers_active, 0) > 0) trace_lattest_stop(li->id, false);
+  li->stopped = false;
+  lattest_threads_stop(li);
+  if (li->id == 0) lattest_load_stop();
+  if (li->thread_prio > 0) {
+    ret = lattest_threads_start(li, &start_cpus, li->thread_prio);
+    if (ret < 0) {
+      mutex_unlock(&li->stat_mutex);
+      return ret;
+    }
+  }
+  lattest_attribution_irqs(li);
+  for_each_cpu(cpu, &start_cpus) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    hrtimer_init(&lc->timer, li->timer_clock, li->timer_mode);
+    lc->timer.function = &lattest_timer_function;
+    lc->last_now_ns = 0;   // to denote the first run
+    lattest_stat_reset(&lc->stat);
+    lattest_stat_reset(&lc->lat);
+    lattest_stat_reset(&lc->stat_last);
+    lattest_stat_reset(&lc->lat_last);
+    lattest_stat_reset(&lc->thr);
+    lattest_stat_reset(&lc->thr_last);
+    lattest_stat_reset(&lc->ovh);
+    lattest_stat_reset(&lc->ovh_last);
+    lc->thr_missed = 0;
+    lc->ipi_csd.func = lattest_ipi_func;
+    lc->ipi_csd.info = lc;
+    lc->ipi_target   = cpu;   // the first IPI goes to the next CPU
+    lc->ipi_pending  = 0;
+    lc->ipi_missed   = 0;
+    if (lc->ipi) {
+      for (src = 0; src < nr_cpu_ids; src++) lattest_stat_reset(&lc->ipi[src]);
+    }
+    for (bucket = 0; bucket < IDLE_BUCKETS; bucket++) lattest_stat_reset(&lc->idle[bucket]);
+    lc->win_head = 0;
+    lc->win_end_ns = 0;   // the first callback starts the first window
+    lc->stream_tail = 0;
+    lattest_attribution_reset(lc, cpu);
+    lc->swap_req = 0;
+    lc->runcount = new_runcount;
+  }
+  if (li->id == 0 && lattest_irq >= 0) {
+    disable_irq(lattest_irq);   // waits for a running handler
+    lattest_stat_reset(&irq_stat);
+    lattest_stat_reset(&irq_stat_last);
+    gpio_toggles = 0;
+    enable_irq(lattest_irq);
+  }
+
+  lattest_outlier_clear(li);
+  cpumask_copy(&li->run_cpus, &start_cpus);
+  lattest_freq_init(&start_cpus);
+  // the CPUs must already stay out of deep idle at the first expiry
+  lattest_qos_request(li);
+
+  // the load must already be there at the first expiry
+  ret = (li->id == 0) ? lattest_load_start(&load_cpus, load_type) : 0;
+  if (ret < 0) {
+    for_each_cpu(cpu, &start_cpus) {
+      per_cpu_ptr(li->cpu_data, cpu)->runcount = 0;
+    }
+    lattest_threads_stop(li);
+    lattest_qos_remove(li);
+    mutex_unlock(&li->stat_mutex);
+    return ret;
+  }
+
+  if (li->timestamp == TS_COUNTER) lattest_counter_measure(li);
+
+  // start timers, each on its own CPU
+  atomic_set(&li->timers_active, cpumask_weight(&start_cpus));
+  trace_lattest_start(li->id, new_runcount, ktime_to_ns(li->period_kt), &start_cpus);
+  on_each_cpu_mask(&start_cpus, lattest_start_cpu, li, 1);
+  mutex_unlock(&li->stat_mutex);
+
+  return count;
+}
+
+/**
+ * Query statistics configuration
+ */
+static ssize_t show_config_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "Histogram mode: %s\nHistogram bin width: %lld\nHistogram bin count: %lld\nHistogram bin offset: %lld\n",
+    ((li->hist_mode == HIST_MODE_LOG) ? "log" : "linear"), li->hist_bin_width, li->hist_bin_num, li->hist_bin_offset);
+}
+
+/**
+ * Configure statistics: number, width and offset of histogram bins
+ *
+ * "<count> <width>" or "<count> <width> <offset>", width and offset in ns,
+ * the offset defaults to 0. Only used for the linear histogram mode.
+ */
+static ssize_t store_config_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  long long new_num;
+  long long new_width;
+  long long new_offset = 0;
+  int ret;
+
+  if (sscanf(buf, "%lld %lld %lld", &new_num, &new_width, &new_offset) < 2) return -EINVAL;
+  if (new_num < 1 || new_num > HIST_BIN_MAX) return -EINVAL;
+  if (new_width < 1 || new_width > HIST_BIN_WIDTH_MAX) return -EINVAL;
+  if (new_offset < -PERIOD_NS_MAX || new_offset > PERIOD_NS_MAX) return -EINVAL;
+
+  ret = lattest_hist_config(li, -1, new_num, new_width, new_offset);
+  if (ret < 0) return ret;
+  printk(KERN_INFO "lattest: Setting histogram to %lld bins of %lld ns, offset %lld ns", new_num, new_width, new_offset);
+  return count;
+}
+
+/**
+ * Print min, max, mean, stddev and percentiles of a statistics block, each
+ * line prefixed
+ */
+static ssize_t lattest_print_stat(const struct lattest_inst *li, char *buf, ssize_t count, const char *prefix, const struct lattest_stat *stat, long long (*bin_low)(const struct lattest_inst *, unsigned int)) {
+  int len;
+  int i;
+  long long stat_mean;
+  long long stat_var;
+  long long stat_stddev;
+  char sumsq[40];   // 2^128 has 39 digits
+
+  // precalculate values
+  lattest_stat_calc(stat, &stat_mean, &stat_var, &stat_stddev);
+  ull128_scnprintf(sumsq, sizeof(sumsq), stat->sumsq);
+  // (we can't use the FPU in a kernel module :-( )
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sMin: %+lldns\n", prefix, stat->min); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sMax: %+lldns\n", prefix, stat->max); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sNum: %lld\n", prefix, stat->num); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sSum: %+lldns\n", prefix, stat->sum); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sMean: ~%+lldns\n", prefix, stat_mean); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sSqSum: %sns²\n", prefix, sumsq); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sVar: %lldns²\n", prefix, stat_var); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sStdDev: %lldns\n", prefix, stat_stddev); count += len;
+  for (i = 0; i < LATTEST_PERCENTILE_NUM; i++) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%s%s: %+lldns\n", prefix, lattest_percentile_names[i],
+      lattest_stat_percentile(li, stat, bin_low, lattest_percentile_ppm[i])); count += len;
+  }
+  return count;
+}
+
+/**
+ * Print the overruns of a latency statistics block, each line prefixed
+ */
+static ssize_t lattest_print_overrun(char *buf, ssize_t count, const char *prefix, const struct lattest_stat *stat) {
+  int len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sOverruns: %lld\n", prefix, stat->overruns); count += len;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%sOverrun Max: %lld at %lldns\n", prefix, stat->overrun_max, stat->overrun_max_ns); count += len;
+  return count;
+}
+
+/**
+ * Print the per-CPU summary line of a statistics block
+ */
+static ssize_t lattest_print_cpu_stat(char *buf, ssize_t count, int cpu, const char *prefix, const struct lattest_stat *stat) {
+  int len;
+  long long stat_mean;
+  long long stat_var;
+  long long stat_stddev;
+
+  lattest_stat_calc(stat, &stat_mean, &stat_var, &stat_stddev);
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d: %sMin: %+lldns Max: %+lldns Num: %lld Mean: ~%+lldns StdDev: %lldns\n",
+    cpu, prefix, stat->min, stat->max, stat->num, stat_mean, stat_stddev); count += len;
+  return count;
+}
+
+/**
+ * Print the histogram of a statistics block, each line prefixed
+ *
+ * The log-linear histograms have too many bins for a single page, therefore
+ * only non-empty bins are printed for them. Output beyond the page is cut
+ * off, histogram in debugfs has all bins.
+ */
+static ssize_t lattest_print_hist(const struct lattest_inst *li, char *buf, ssize_t count, const char *prefix, const struct lattest_stat *stat, long long (*bin_low)(const struct lattest_inst *, unsigned int)) {
+  int len;
+  int sparse = (li->hist_mode == HIST_MODE_LOG);
+  int i;
+
+  if (!sparse || stat->histogram[0] != 0) {
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%s <  %+6lldns: %llu\n", prefix, bin_low(li, 1), stat->histogram[0]); count += len;
+  }
+  for (i = 1; i < stat->hist_num; i++) {
+    if (sparse && stat->histogram[i] == 0) continue;
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%s >= %+6lldns: %llu\n", prefix, bin_low(li, i), stat->histogram[i]); count += len;
+  }
+  return count;
+}
+
+/**
+ * Print the IPI statistics merged over all pairs of CPUs, the summary of
+ * each pair and the merged histogram
+ *
+ * Must be called with stat_mutex held.
+ */
+static ssize_t lattest_print_ipi(struct lattest_inst *li, char *buf, ssize_t count) {
+  struct lattest_stat ipi;
+  struct lattest_stat pair;
+  char prefix[32];
+  int cpu;
+  int src;
+
+  if (lattest_stat_alloc(&ipi, lattest_latency_bins(li)) < 0) return count;
+  for_each_lattest_cpu(li, cpu) {
+    for_each_lattest_cpu(li, src) {
+      if (src == cpu) continue;
+      lattest_ipi_stat_get(per_cpu_ptr(li->cpu_data, cpu), src, &pair);
+      lattest_stat_merge(&ipi, &pair);
+    }
+  }
+  count = lattest_print_stat(li, buf, count, "IPI ", &ipi, lattest_latency_bin_low);
+  for_each_lattest_cpu(li, cpu) {
+    for_each_lattest_cpu(li, src) {
+      if (src == cpu) continue;
+      lattest_ipi_stat_get(per_cpu_ptr(li->cpu_data, cpu), src, &pair);
+      snprintf(prefix, sizeof(prefix), "IPI from CPU%d ", src);
+      count = lattest_print_cpu_stat(buf, count, cpu, prefix, &pair);
+    }
+  }
+  count = lattest_print_hist(li, buf, count, "IPI", &ipi, lattest_latency_bin_low);
+  lattest_stat_free(&ipi);
+  return count;
+}
+
+/**
+ * Print the per-CPU latency summary of each idle state the timers woke the
+ * CPUs from, "busy" if they weren't idle
+ *
+ * Must be called with stat_mutex held.
+ */
+static ssize_t lattest_print_idle(struct lattest_inst *li, char *buf, ssize_t count) {
+  struct lattest_stat idle;
+  char name[CPUIDLE_NAME_LEN];
+  char prefix[CPUIDLE_NAME_LEN + 16];
+  int cpu;
+  int bucket;
+
+  for_each_lattest_cpu(li, cpu) {
+    for (bucket = 0; bucket < IDLE_BUCKETS; bucket++) {
+      lattest_idle_stat_get(per_cpu_ptr(li->cpu_data, cpu), bucket, &idle);
+      if (idle.num == 0) continue;
+      lattest_idle_name(bucket, name, sizeof(name));
+      snprintf(prefix, sizeof(prefix), "Latency from %s ", name);
+      count = lattest_print_cpu_stat(buf, count, cpu, prefix, &idle);
+    }
+  }
+  return count;
+}
+
+/**
+ * Print statistics: min, max, mean, stddev, histogram
+ *
+ * The first blocks (jitter, then latency) and the histograms are merged over
+ * all CPUs, the per-CPU summary lines are in between.
+ */
+static ssize_t lattest_print_statistics(struct lattest_inst *li, char *buf, int last) {
+  ssize_t count = 0;
+  int len;
+  struct lattest_stat stat;
+  struct lattest_stat lat;
+  struct lattest_stat thr;
+  struct lattest_stat ovh;
+  struct lattest_stat irq;
+  struct lattest_stat cpu_stat;
+  struct lattest_stat cpu_lat;
+  struct lattest_stat cpu_thr;
+  struct lattest_stat cpu_ovh;
+  int cpu;
+
+  mutex_lock(&li->stat_mutex);
+  if (lattest_stat_alloc(&stat, lattest_jitter_bins(li)) < 0) goto err_stat;
+  if (lattest_stat_alloc(&lat, lattest_latency_bins(li)) < 0) goto err_lat;
+  if (lattest_stat_alloc(&thr, lattest_latency_bins(li)) < 0) goto err_thr;
+  if (lattest_stat_alloc(&ovh, lattest_latency_bins(li)) < 0) goto err_ovh;
+  lattest_stat_merge_all(li, last, &stat, &lat, &thr, &ovh);
+
+  count = lattest_print_stat(li, buf, count, "",         &stat, lattest_jitter_bin_low);
+  count = lattest_print_stat(li, buf, count, "Latency ", &lat,  lattest_latency_bin_low);
+  count = lattest_print_overrun(buf, count, "", &lat);
+  count = lattest_print_stat(li, buf, count, "Overhead ", &ovh, lattest_latency_bin_low);
+  // the thread latency is only there if the threads ran in this interval
+  if (thr.num > 0) count = lattest_print_stat(li, buf, count, "Thread ", &thr, lattest_latency_bin_low);
+  // the loopback IRQ isn't per CPU, its copy shares the histogram
+  lattest_irq_stat_get(li, last, &irq);
+  if (irq.num > 0) count = lattest_print_stat(li, buf, count, "IRQ ", &irq, lattest_latency_bin_low);
+  // per-CPU summary
+  for_each_lattest_cpu(li, cpu) {
+    lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), last, &cpu_stat, &cpu_lat, &cpu_thr, &cpu_ovh);
+    count = lattest_print_cpu_stat(buf, count, cpu, "",         &cpu_stat);
+    count = lattest_print_cpu_stat(buf, count, cpu, "Latency ", &cpu_lat);
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d: Overruns: %lld Max: %lld at %lldns\n",
+      cpu, cpu_lat.overruns, cpu_lat.overrun_max, cpu_lat.overrun_max_ns); count += len;
+    count = lattest_print_cpu_stat(buf, count, cpu, "Overhead ", &cpu_ovh);
+    if (thr.num > 0) count = lattest_print_cpu_stat(buf, count, cpu, "Thread ", &cpu_thr);
+  }
+  // histograms
+  count = lattest_print_hist(li, buf, count, "",        &stat, lattest_jitter_bin_low);
+  count = lattest_print_hist(li, buf, count, "Latency", &lat,  lattest_latency_bin_low);
+  count = lattest_print_hist(li, buf, count, "Overhead", &ovh, lattest_latency_bin_low);
+  if (thr.num > 0) count = lattest_print_hist(li, buf, count, "Thread", &thr, lattest_latency_bin_low);
+  if (irq.num > 0) count = lattest_print_hist(li, buf, count, "IRQ", &irq, lattest_latency_bin_low);
+  // IPIs since the start, they aren't affected by "reset"
+  if (li->ipi && !last) count = lattest_print_ipi(li, buf, count);
+  // idle states since the start, also not affected by "reset"
+  if (!last) count = lattest_print_idle(li, buf, count);
+  lattest_stat_free(&ovh);
+  lattest_stat_free(&thr);
+  lattest_stat_free(&lat);
+  lattest_stat_free(&stat);
+  mutex_unlock(&li->stat_mutex);
+  return count;
+
+err_ovh:
+  lattest_stat_free(&thr);
+err_thr:
+  lattest_stat_free(&lat);
+err_lat:
+  lattest_stat_free(&stat);
+err_stat:
+  mutex_unlock(&li->stat_mutex);
+  return -ENOMEM;
+}
+
+/**
+ * Query statistics: min, max, mean, stddev, histogram
+ */
+static ssize_t show_statistics_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return lattest_print_statistics(li, buf, 0);
+}
+
+/**
+ * Query statistics of the interval before the last reset
+ */
+static ssize_t show_statistics_last_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return lattest_print_statistics(li, buf, 1);
+}
+
+/**
+ * Query histogram mode
+ */
+static ssize_t show_hist_mode_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%s\n", ((li->hist_mode == HIST_MODE_LOG) ? "log" : "linear"));
+}
+
+/**
+ * Set histogram mode
+ *
+ * "linear": hist_bin_num bins of hist_bin_width, see config
+ * "log":    log-linear bins from 1ns to ~17s with <= 1.6% relative width
+ */
+static ssize_t store_hist_mode_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  int new_mode;
+  int ret;
+
+  if (sysfs_streq(buf, "linear")) {
+    new_mode = HIST_MODE_LINEAR;
+  } else if (sysfs_streq(buf, "log")) {
+    new_mode = HIST_MODE_LOG;
+  } else {
+    return -EINVAL;
+  }
+
+  ret = lattest_hist_config(li, new_mode, 0, 0, 0);
+  if (ret < 0) return ret;
+  printk(KERN_INFO "lattest: Setting histogram mode to %s", ((new_mode == HIST_MODE_LOG) ? "log" : "linear"));
+  return count;
+}
+
+/**
+ * Query list of CPUs to run a timer on
+ */
+static ssize_t show_cpus_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%*pbl\n", cpumask_pr_args(&li->cpus));
+}
+
+/**
+ * Set list of CPUs to run a timer on, e.g., "0-3" or "1,3"
+ *
+ * Only online CPUs are allowed.
+ */
+static ssize_t store_cpus_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  struct cpumask new_cpus;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (cpulist_parse(buf, &new_cpus) < 0) return -EINVAL;
+  if (cpumask_empty(&new_cpus)) return -EINVAL;
+  if (!cpumask_subset(&new_cpus, cpu_online_mask)) return -EINVAL;
+
+  cpumask_copy(&li->cpus, &new_cpus);
+  printk(KERN_INFO "lattest: Setting CPUs to %*pbl", cpumask_pr_args(&li->cpus));
+  return count;
+}
+
+static struct class  *s_pDeviceClass;
+static DEVICE_ATTR(status,     S_IRUSR           | S_IRGRP           | S_IROTH          , show_status_cb,     NULL);
+static DEVICE_ATTR(period,     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_period_cb,     store_period_cb);
+static DEVICE_ATTR(period_ns,  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_period_ns_cb,  store_period_ns_cb);
+static DEVICE_ATTR(control,              S_IWUSR           | S_IWGRP                    , NULL,               store_control_cb);
+static DEVICE_ATTR(config,     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_config_cb,     store_config_cb);
+static DEVICE_ATTR(hist_mode,  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_hist_mode_cb,  store_hist_mode_cb);
+static DEVICE_ATTR(statistics, S_IRUSR           | S_IRGRP           | S_IROTH          , show_statistics_cb, NULL);
+static DEVICE_ATTR(statistics_last, S_IRUSR      | S_IRGRP           | S_IROTH          , show_statistics_last_cb, NULL);
+/**
+ * Query hrtimer mode
+ */
+static ssize_t show_timer_mode_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%s\n", lattest_timer_mode_str(li->timer_mode));
+}
+
+/**
+ * Set hrtimer mode, applied at the next start
+ *
+ * Space separated list of modifiers of the current mode:
+ *   "abs" ........ absolute expiry times on a fixed grid (default)
+ *   "rel" ........ next expiry is a period after the callback, so the
+ *                  jitter is the latency of the callback, a latency of
+ *                  n full periods counts as n overruns
+ *   "pinned" ..... timer doesn't migrate away from its CPU (default, the only
+ *                  choice: the per-CPU state has the timer of its CPU as the
+ *                  only writer, "unpinned" timers can be moved to a
+ *                  housekeeping CPU by nohz)
+ *   "hard" ....... expire in hard interrupt context, also on PREEMPT_RT (default)
+ *   "soft" ....... expire in softirq context
+ *   "default" .... kernel default, i.e., softirq on PREEMPT_RT, else hard interrupt
+ */
+static ssize_t store_timer_mode_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  char tmp[64];
+  char *str = tmp;
+  char *tok;
+  int new_mode = li->timer_mode;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (strscpy(tmp, buf, sizeof(tmp)) < 0) return -EINVAL;
+  while ((tok = strsep(&str, " \t\n")) != NULL) {
+    if (*tok == '\0') continue;
+    if      (strcmp(tok, "abs")      == 0) new_mode &= ~HRTIMER_MODE_REL;
+    else if (strcmp(tok, "rel")      == 0) new_mode |=  HRTIMER_MODE_REL;
+    else if (strcmp(tok, "pinned")   == 0) new_mode |=  HRTIMER_MODE_PINNED;
+    else if (strcmp(tok, "unpinned") == 0) return -EINVAL;   // see above
+    else if (strcmp(tok, "hard")     == 0) new_mode  = (new_mode & ~HRTIMER_MODE_SOFT) | HRTIMER_MODE_HARD;
+    else if (strcmp(tok, "soft")     == 0) new_mode  = (new_mode & ~HRTIMER_MODE_HARD) | HRTIMER_MODE_SOFT;
+    else if (strcmp(tok, "default")  == 0) new_mode &= ~(HRTIMER_MODE_SOFT | HRTIMER_MODE_HARD);
+    else return -EINVAL;
+  }
+
+  li->timer_mode = new_mode;
+  printk(KERN_INFO "lattest: Setting timer mode to %s", lattest_timer_mode_str(li->timer_mode));
+  return count;
+}
+
+/**
+ * Query hrtimer clock
+ */
+static ssize_t show_clock_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%s\n", lattest_clock_str(li->timer_clock));
+}
+
+/**
+ * Set hrtimer clock, applied at the next start: "monotonic", "tai" or "boottime"
+ */
+static ssize_t store_clock_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (sysfs_streq(buf, "monotonic")) {
+    li->timer_clock = CLOCK_MONOTONIC;
+  } else if (sysfs_streq(buf, "tai")) {
+    li->timer_clock = CLOCK_TAI;
+  } else if (sysfs_streq(buf, "boottime")) {
+    li->timer_clock = CLOCK_BOOTTIME;
+  } else {
+    return -EINVAL;
+  }
+  printk(KERN_INFO "lattest: Setting timer clock to %s", lattest_clock_str(li->timer_clock));
+  return count;
+}
+
+/**
+ * Query timestamp source of the timer callbacks
+ */
+static ssize_t show_timestamp_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%s\n", lattest_ts_names[li->timestamp]);
+}
+
+/**
+ * Set timestamp source of the timer callbacks, applied at the next start
+ *
+ * "ktime":   the timer's clock, its resolution is that of the clocksource
+ * "counter": the ARM generic timer counter (CNTVCT), calibrated against the
+ *            timer's clock, cheaper to read and with the counter's resolution
+ *
+ * The wakeup threads and the GPIO loopback always use ktime.
+ */
+static ssize_t store_timestamp_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  u32 rate;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (sysfs_streq(buf, "ktime")) {
+    li->timestamp = TS_KTIME;
+  } else if (sysfs_streq(buf, "counter")) {
+    rate = lattest_counter_rate();
+    if (rate == 0) return -ENODEV;   // no generic timer
+    li->ts_rate = rate;
+    // the products of ts_mult must not overflow until the next calibration
+    clocks_calc_mult_shift(&li->ts_mult, &li->ts_shift, rate, NSEC_PER_SEC, 4);   // measured at the start
+    li->timestamp = TS_COUNTER;
+  } else {
+    return -EINVAL;
+  }
+  printk(KERN_INFO "lattest: Setting timestamp source to %s", lattest_ts_names[li->timestamp]);
+  return count;
+}
+
+/**
+ * Query SCHED_FIFO priority of the wakeup threads
+ */
+static ssize_t show_thread_prio_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%d\n", li->thread_prio);
+}
+
+/**
+ * Set SCHED_FIFO priority of the wakeup threads, applied at the next start
+ *
+ * 0 disables the threads, 1 to 99 lets each timer wake a thread bound to its
+ * CPU, which records its own wakeup latency.
+ */
+static ssize_t store_thread_prio_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  int new_prio;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtoint(buf, 10, &new_prio) < 0) return -EINVAL;
+  if (new_prio < 0 || new_prio >= MAX_RT_PRIO) return -EINVAL;
+  li->thread_prio = new_prio;
+  printk(KERN_INFO "lattest: Setting wakeup thread priority to %d", li->thread_prio);
+  return count;
+}
+
+/**
+ * Query whether the timers send IPIs
+ */
+static ssize_t show_ipi_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%d\n", li->ipi);
+}
+
+/**
+ * Enable or disable the IPIs, applied at the next start
+ *
+ * With IPIs, the timer on each CPU of cpus sends an IPI to the next other
+ * CPU of cpus at every expiry, whose handler records the delivery latency
+ * for this pair of CPUs. Needs at least two CPUs.
+ */
+static ssize_t store_ipi_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  bool new_ipi;
+  int ret;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtobool(buf, &new_ipi) < 0) return -EINVAL;
+  if (new_ipi == li->ipi) return count;
+  if (new_ipi) {
+    ret = lattest_ipi_alloc(li);
+    if (ret < 0) return ret;
+  } else {
+    li->ipi = false;
+    lattest_ipi_free(li);
+  }
+  printk(KERN_INFO "lattest: Setting IPIs to %d", li->ipi);
+  return count;
+}
+
+/**
+ * Query the CPU latency limit requested during a run
+ */
+static ssize_t show_idle_qos_us_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%d\n", li->idle_qos_us);
+}
+
+/**
+ * Set the CPU latency limit in us requested via PM QoS during a run, -1 to
+ * disable, applied at the next start
+ *
+ * The cpuidle governors then only select idle states with a lower exit
+ * latency, 0 keeps the CPUs polling. The limit applies to all CPUs and is
+ * dropped at the end of the run.
+ */
+static ssize_t store_idle_qos_us_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  int new_qos_us;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtoint(buf, 10, &new_qos_us) < 0) return -EINVAL;
+  if (new_qos_us < -1) return -EINVAL;
+  li->idle_qos_us = new_qos_us;
+  printk(KERN_INFO "lattest: Setting idle QoS to %d us", li->idle_qos_us);
+  return count;
+}
+
+/**
+ * Query background load type
+ */
+static ssize_t show_load_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  return scnprintf(buf, PAGE_SIZE, "%s\n", lattest_load_names[load_type]);
+}
+
+/**
+ * Set background load type, applied at the next start
+ *
+ * "none", "cache" (cache thrashing), "membw" (memory bandwidth), "ipi"
+ * (self-IPI storm) or "spinlock" (spinlock contention with interrupts
+ * disabled)
+ */
+static ssize_t store_load_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  int new_type;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  new_type = sysfs_match_string(lattest_load_names, buf);
+  if (new_type < 0) return -EINVAL;
+  load_type = new_type;
+  printk(KERN_INFO "lattest: Setting load to %s", lattest_load_names[load_type]);
+  return count;
+}
+
+/**
+ * Query list of CPUs to run a load thread on
+ */
+static ssize_t show_load_cpus_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  return scnprintf(buf, PAGE_SIZE, "%*pbl\n", cpumask_pr_args(&load_cpus));
+}
+
+/**
+ * Set list of CPUs to run a load thread on, e.g., "0-3" or "1,3"
+ *
+ * The load CPUs may overlap with the timer CPUs.
+ */
+static ssize_t store_load_cpus_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  struct cpumask new_cpus;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (cpulist_parse(buf, &new_cpus) < 0) return -EINVAL;
+  if (!cpumask_subset(&new_cpus, cpu_online_mask)) return -EINVAL;
+
+  cpumask_copy(&load_cpus, &new_cpus);
+  printk(KERN_INFO "lattest: Setting load CPUs to %*pbl", cpumask_pr_args(&load_cpus));
+  return count;
+}
+
+/**
+ * Query latency threshold of the outlier log in ns
+ */
+static ssize_t show_threshold_ns_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%lld\n", li->outlier_threshold_ns);
+}
+
+/**
+ * Set latency threshold of the outlier log in ns, 0 disables the log
+ *
+ * Callback and wakeup thread latencies above are logged.
+ */
+static ssize_t store_threshold_ns_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  long long new_threshold;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtoll(buf, 10, &new_threshold) < 0) return -EINVAL;
+  if (new_threshold < 0) return -EINVAL;
+  li->outlier_threshold_ns = new_threshold;
+  printk(KERN_INFO "lattest: Setting outlier threshold to %lldns", li->outlier_threshold_ns);
+  return count;
+}
+
+/**
+ * Query whether the first outlier calls tracing_off()
+ */
+static ssize_t show_breaktrace_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%d\n", li->breaktrace);
+}
+
+/**
+ * Set whether the first outlier calls tracing_off(), "0" or "1"
+ *
+ * Tracing has to be switched on again by writing 1 to tracing_on of ftrace.
+ */
+static ssize_t store_breaktrace_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  bool new_breaktrace;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtobool(buf, &new_breaktrace) < 0) return -EINVAL;
+  li->breaktrace = new_breaktrace;
+  printk(KERN_INFO "lattest: Setting breaktrace to %d", li->breaktrace);
+  return count;
+}
+
+/**
+ * Query events: number of notifications and the events of the last one
+ *
+ * sysfs_notify() is called for this attribute at each notification, and for
+ * status when a run has finished, so userspace can poll() for POLLPRI
+ * instead of reading status repeatedly. Similar events are merged until the
+ * notification was sent.
+ */
+static ssize_t show_event_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  unsigned int events = li->event_last;
+  return scnprintf(buf, PAGE_SIZE, "%u%s%s\n", li->event_num,
+    ((events & BIT(EVENT_DONE)) ? " done" : ""), ((events & BIT(EVENT_OUTLIER)) ? " outlier" : ""));
+}
+
+/**
+ * Query outlier log, oldest first
+ *
+ * The log is copied first so the timers aren't blocked while printing. Only
+ * the newest OUTLIER_TEXT_LINES outliers fit into a page. The IRQ numbers
+ * are those of /proc/interrupts.
+ */
+static ssize_t show_outliers_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  ssize_t count = 0;
+  int len;
+  struct lattest_outlier *log;
+  long long num;
+  long long i;
+  int j;
+  unsigned long flags;
+
+  log = kmalloc(sizeof(li->outlier_log), GFP_KERNEL);
+  if (!log) return -ENOMEM;
+  raw_spin_lock_irqsave(&li->outlier_lock, flags);
+  memcpy(log, li->outlier_log, sizeof(li->outlier_log));
+  num = li->outlier_num;
+  raw_spin_unlock_irqrestore(&li->outlier_lock, flags);
+
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Outliers: %lld\n", num); count += len;
+  for (i = max(0LL, num - OUTLIER_TEXT_LINES); i < num; i++) {
+    struct lattest_outlier *o = &log[i & (OUTLIER_LOG_SIZE-1)];
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, "%lldns CPU%d %s: %+lldns IRQs: %u",
+      o->timestamp_ns, o->cpu, lattest_outlier_names[o->source], o->latency_ns, o->att.hardirqs); count += len;
+    for (j = 0; j < OUTLIER_IRQS && o->att.irq_num[j] > 0; j++) {
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, " %u:%u", o->att.irq[j], o->att.irq_num[j]); count += len;
+    }
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, " Softirqs:"); count += len;
+    for (j = 0; j < NR_SOFTIRQS; j++) {
+      if (o->att.softirqs[j] == 0) continue;
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, " %s:%u", lattest_softirq_names[j], o->att.softirqs[j]); count += len;
+    }
+    len = scnprintf(&(buf[count]), PAGE_SIZE-count, " Task: %.*s/%d\n",
+      (int)sizeof(o->att.comm), o->att.comm, o->att.pid); count += len;
+  }
+  kfree(log);
+  return count;
+}
+
+/**
+ * Query length of the rolling windows in ms
+ */
+static ssize_t show_window_ms_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%lld\n", div_ll(li->window_ns, NSEC_PER_MSEC));
+}
+
+/**
+ * Set length of the rolling windows in ms, 0 disables them
+ *
+ * Max. WINDOW_MS_MAX allowed.
+ */
+static ssize_t store_window_ms_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  unsigned int new_ms;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtouint(buf, 10, &new_ms) < 0) return -EINVAL;
+  if (new_ms > WINDOW_MS_MAX) return -EINVAL;
+  li->window_ns = (long long)new_ms * NSEC_PER_MSEC;
+  printk(KERN_INFO "lattest: Setting window to %u ms", new_ms);
+  return count;
+}
+
+/**
+ * Query the newest rolling window summaries of each CPU, oldest first
+ *
+ * Only WINDOW_TEXT_LINES windows fit into a page, windows_bin has all of
+ * them.
+ */
+static ssize_t show_windows_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  ssize_t count = 0;
+  int len;
+  struct lattest_window *win;
+  unsigned int per_cpu_num = max(1U, WINDOW_TEXT_LINES / max(1U, cpumask_weight(&li->run_cpus)));
+  unsigned int num;
+  unsigned int i;
+  int cpu;
+
+  win = kvcalloc(per_cpu_num, sizeof(*win), GFP_KERNEL);
+  if (!win) return -ENOMEM;
+  len = scnprintf(&(buf[count]), PAGE_SIZE-count, "Window: %lldns\nRealtime offset: %lldns\n",
+    li->window_ns, lattest_realtime_offset(li)); count += len;
+  for_each_lattest_cpu(li, cpu) {
+    num = lattest_window_get(per_cpu_ptr(li->cpu_data, cpu), win, per_cpu_num);
+    for (i = 0; i < num; i++) {
+      len = scnprintf(&(buf[count]), PAGE_SIZE-count, "CPU%d %lldns: Num: %lld Min: %+lldns Max: %+lldns Mean: ~%+lldns Overruns: %lld\n",
+        cpu, win[i].start_ns, win[i].num, win[i].min, win[i].max, div_ll(win[i].sum, win[i].num), win[i].overruns); count += len;
+    }
+  }
+  kvfree(win);
+  return count;
+}
+
+/**
+ * Query whether the finished windows are streamed
+ */
+static ssize_t show_stream_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%d\n", li->stream);
+}
+
+/**
+ * Enable or disable streaming of the finished windows via generic netlink
+ *
+ * Allowed while running, e.g., to attach a collector to a long run.
+ */
+static ssize_t store_stream_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  bool new_stream;
+
+  if (kstrtobool(buf, &new_stream) < 0) return -EINVAL;
+  if (new_stream == li->stream) return count;
+  if (new_stream) {
+    lattest_stream_start(li);
+  } else {
+    lattest_stream_stop(li);
+  }
+  printk(KERN_INFO "lattest: Setting stream to %d", new_stream);
+  return count;
+}
+
+/**
+ * Query number of samples per CPU ring buffer
+ */
+static ssize_t show_ringbuffer_cb(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%u\n", li->ring_size);
+}
+
+/**
+ * Set number of samples per CPU ring buffer, rounded up to a power of 2
+ *
+ * 0 frees the ring buffers. Not allowed while the rings are mapped.
+ */
+static ssize_t store_ringbuffer_cb(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(dev);
+  unsigned int new_size;
+  int ret = 0;
+  if (lattest_running(li)) return -EINVAL;   // timer running
+
+  if (kstrtouint(buf, 10, &new_size) < 0) return -EINVAL;
+  if (new_size > RING_SIZE_MAX) return -EINVAL;
+  if (new_size > 0) new_size = roundup_pow_of_two(new_size);
+
+  mutex_lock(&li->ring_mutex);
+  if (atomic_read(&li->ring_mapped) != 0) {
+    ret = -EBUSY;
+  } else if (new_size != li->ring_size) {
+    lattest_ring_free(li);
+    if (new_size > 0) ret = lattest_ring_alloc(li, new_size);
+  }
+  mutex_unlock(&li->ring_mutex);
+  if (ret < 0) return ret;
+
+  printk(KERN_INFO "lattest: Setting ring buffer size to %u samples per CPU", li->ring_size);
+  return count;
+}
+
+static DEVICE_ATTR(cpus,       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_cpus_cb,       store_cpus_cb);
+static DEVICE_ATTR(timer_mode, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_timer_mode_cb, store_timer_mode_cb);
+static DEVICE_ATTR(clock,      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_clock_cb,      store_clock_cb);
+static DEVICE_ATTR(event,      S_IRUSR           | S_IRGRP           | S_IROTH          , show_event_cb,      NULL);
+static DEVICE_ATTR(timestamp,  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_timestamp_cb,  store_timestamp_cb);
+static DEVICE_ATTR(thread_prio, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH         , show_thread_prio_cb, store_thread_prio_cb);
+static DEVICE_ATTR(ipi,        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_ipi_cb,        store_ipi_cb);
+static DEVICE_ATTR(idle_qos_us, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH         , show_idle_qos_us_cb, store_idle_qos_us_cb);
+static DEVICE_ATTR(load,       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_load_cb,       store_load_cb);
+static DEVICE_ATTR(load_cpus,  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_load_cpus_cb,  store_load_cpus_cb);
+static DEVICE_ATTR(threshold_ns, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH        , show_threshold_ns_cb, store_threshold_ns_cb);
+static DEVICE_ATTR(breaktrace, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_breaktrace_cb, store_breaktrace_cb);
+static DEVICE_ATTR(outliers,   S_IRUSR           | S_IRGRP           | S_IROTH          , show_outliers_cb,   NULL);
+static DEVICE_ATTR(window_ms,  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_window_ms_cb,  store_window_ms_cb);
+static DEVICE_ATTR(windows,    S_IRUSR           | S_IRGRP           | S_IROTH          , show_windows_cb,    NULL);
+static DEVICE_ATTR(stream,     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_stream_cb,     store_stream_cb);
+static DEVICE_ATTR(ringbuffer, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH          , show_ringbuffer_cb, store_ringbuffer_cb);
+
+
+/**
+ * Copy the counters of a statistics block into the snapshot
+ */
+static void lattest_snapshot_stat_fill(const struct lattest_inst *li, struct lattest_snapshot_stat *snap, const struct lattest_stat *stat, size_t hist_offset, long long (*bin_low)(const struct lattest_inst *, unsigned int)) {
+  int i;
+  snap->min         = stat->min;
+  snap->max         = stat->max;
+  snap->num         = stat->num;
+  snap->sum         = stat->sum;
+  snap->sumsq_hi    = stat->sumsq.hi;
+  snap->sumsq_lo    = stat->sumsq.lo;
+  snap->hist_num    = stat->hist_num;
+  snap->hist_offset = hist_offset;
+  for (i = 0; i < LATTEST_PERCENTILE_NUM; i++) {
+    snap->percentile[i] = lattest_stat_percentile(li, stat, bin_low, lattest_percentile_ppm[i]);
+  }
+}
+
+/**
+ * Take a new binary statistics snapshot into sb
+ *
+ * The histograms in the snapshot are used directly as merge destination.
+ */
+static int lattest_snapshot_take(struct lattest_inst *li, int last, struct lattest_snapshot_buf *sb) {
+  struct lattest_snapshot *snap;
+  struct lattest_stat jitter;
+  struct lattest_stat latency;
+  struct lattest_stat thread;
+  struct lattest_stat irq;
+  struct lattest_stat overhead;
+  size_t jitter_offset;
+  size_t latency_offset;
+  size_t thread_offset;
+  size_t irq_offset;
+  size_t overhead_offset;
+  size_t size;
+
+  jitter.hist_num  = lattest_jitter_bins(li);
+  latency.hist_num = lattest_latency_bins(li);
+  thread.hist_num  = lattest_latency_bins(li);
+  overhead.hist_num = lattest_latency_bins(li);
+  jitter_offset    = sizeof(*snap);
+  latency_offset   = jitter_offset  + jitter.hist_num*sizeof(u64);
+  thread_offset    = latency_offset + latency.hist_num*sizeof(u64);
+  irq_offset       = thread_offset  + thread.hist_num*sizeof(u64);
+  overhead_offset  = irq_offset     + lattest_latency_bins(li)*sizeof(u64);
+  size             = overhead_offset + overhead.hist_num*sizeof(u64);
+
+  if (size != sb->size) {
+    kvfree(sb->buf);
+    sb->size = 0;
+    sb->buf = kvzalloc(size, GFP_KERNEL);
+    if (!sb->buf) return -ENOMEM;
+    sb->size = size;
+  }
+  snap = sb->buf;
+  jitter.histogram  = (u64 *)((char *)sb->buf + jitter_offset);
+  latency.histogram = (u64 *)((char *)sb->buf + latency_offset);
+  thread.histogram  = (u64 *)((char *)sb->buf + thread_offset);
+  overhead.histogram = (u64 *)((char *)sb->buf + overhead_offset);
+  lattest_stat_reset(&jitter);
+  lattest_stat_reset(&latency);
+  lattest_stat_reset(&thread);
+  lattest_stat_reset(&overhead);
+  lattest_stat_merge_all(li, last, &jitter, &latency, &thread, &overhead);
+  lattest_irq_stat_get(li, last, &irq);
+  memcpy((char *)sb->buf + irq_offset, irq.histogram, irq.hist_num*sizeof(u64));
+  irq.histogram = (u64 *)((char *)sb->buf + irq_offset);
+
+  snap->version         = LATTEST_SNAPSHOT_VERSION;
+  snap->size            = size;
+  snap->hist_mode       = li->hist_mode;
+  snap->hist_bin_width  = li->hist_bin_width;
+  snap->hist_bin_offset = li->hist_bin_offset;
+  snap->period_ns       = ktime_to_ns(li->period_kt);
+  lattest_snapshot_stat_fill(li, &snap->jitter,  &jitter,  jitter_offset,  lattest_jitter_bin_low);
+  lattest_snapshot_stat_fill(li, &snap->latency, &latency, latency_offset, lattest_latency_bin_low);
+  lattest_snapshot_stat_fill(li, &snap->thread,  &thread,  thread_offset,  lattest_latency_bin_low);
+  lattest_snapshot_stat_fill(li, &snap->irq,     &irq,     irq_offset,     lattest_latency_bin_low);
+  lattest_snapshot_stat_fill(li, &snap->overhead, &overhead, overhead_offset, lattest_latency_bin_low);
+  snap->overruns        = latency.overruns;
+  snap->overrun_max     = latency.overrun_max;
+  snap->overrun_max_ns  = latency.overrun_max_ns;
+  return 0;
+}
+
+/**
+ * Take a new binary snapshot of all rolling windows into sb
+ */
+static int lattest_windows_take(struct lattest_inst *li, struct lattest_snapshot_buf *sb) {
+  struct lattest_windows *hdr;
+  struct lattest_window *win;
+  unsigned int num = 0;
+  int cpu;
+
+  kvfree(sb->buf);
+  sb->size = 0;
+  sb->buf = kvzalloc(sizeof(*hdr) + cpumask_weight(&li->run_cpus)*WINDOW_NUM*sizeof(*win), GFP_KERNEL);
+  if (!sb->buf) return -ENOMEM;
+  hdr = sb->buf;
+  win = (struct lattest_window *)(hdr + 1);
+  for_each_lattest_cpu(li, cpu) {
+    num += lattest_window_get(per_cpu_ptr(li->cpu_data, cpu), &win[num], WINDOW_NUM);
+  }
+  hdr->version            = LATTEST_WINDOWS_VERSION;
+  hdr->size               = sizeof(*hdr) + num*sizeof(*win);
+  hdr->num                = num;
+  hdr->window_ns          = li->window_ns;
+  hdr->realtime_offset_ns = lattest_realtime_offset(li);
+  sb->size = hdr->size;
+  return 0;
+}
+
+/**
+ * Snapshot buffer of the reader filp, a new one for a read at offset 0
+ *
+ * sysfs has no release for binary attributes, so the buffers stay with the
+ * file until a new reader needs one and the least recently read one is
+ * taken over. Must be called with snapshot_mutex held. NULL if the reader's
+ * buffer was taken over.
+ */
+static struct lattest_snapshot_buf *lattest_snapshot_slot(struct lattest_inst *li, int last, const struct file *filp, bool create) {
+  struct lattest_snapshot_buf *slots = li->snapshot_buf[last];
+  struct lattest_snapshot_buf *sb = NULL;
+  int i;
+
+  for (i = 0; i < SNAPSHOT_READERS; i++) {
+    if (slots[i].filp == filp) sb = &slots[i];
+  }
+  if (!sb && create) {
+    sb = &slots[0];
+    for (i = 1; i < SNAPSHOT_READERS; i++) {
+      if (slots[i].used < sb->used) sb = &slots[i];
+    }
+    sb->filp = filp;
+  }
+  if (sb) sb->used = ++li->snapshot_used;
+  return sb;
+}
+
+/**
+ * Free the snapshot buffers of all readers
+ */
+static void lattest_snapshot_free(struct lattest_inst *li) {
+  int last;
+  int i;
+  for (last = 0; last < ARRAY_SIZE(li->snapshot_buf); last++) {
+    for (i = 0; i < SNAPSHOT_READERS; i++) {
+      kvfree(li->snapshot_buf[last][i].buf);
+      li->snapshot_buf[last][i].buf  = NULL;
+      li->snapshot_buf[last][i].size = 0;
+      li->snapshot_buf[last][i].filp = NULL;
+    }
+  }
+}
+
+/**
+ * Read binary statistics snapshot
+ *
+ * A read at offset 0 takes a new snapshot for this open file, all its other
+ * reads copy from it, so a large snapshot read in several chunks is
+ * consistent, also with other readers at the same time. With more than
+ * SNAPSHOT_READERS concurrent readers, the one which read least recently
+ * loses its snapshot and gets -ESTALE.
+ */
+static ssize_t lattest_read_snapshot(struct lattest_inst *li, int last, struct file *filp, char *buf, loff_t off, size_t count) {
+  struct lattest_snapshot_buf *sb;
+  ssize_t ret;
+
+  mutex_lock(&li->snapshot_mutex);
+  sb = lattest_snapshot_slot(li, last, filp, off == 0);
+  if (!sb) {
+    ret = -ESTALE;
+    goto out;
+  }
+  if (off == 0) {
+    mutex_lock(&li->stat_mutex);
+    ret = (last == SNAPSHOT_WINDOWS) ? lattest_windows_take(li, sb) : lattest_snapshot_take(li, last, sb);
+    mutex_unlock(&li->stat_mutex);
+    if (ret < 0) {
+      sb->filp = NULL;
+      goto out;
+    }
+  }
+  if (off >= sb->size) {
+    ret = 0;
+    goto out;
+  }
+  count = min_t(size_t, count, sb->size - off);
+  memcpy(buf, (char *)sb->buf + off, count);
+  ret = count;
+out:
+  mutex_unlock(&li->snapshot_mutex);
+  return ret;
+}
+
+static ssize_t read_statistics_bin_cb(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(kobj_to_dev(kobj));
+  return lattest_read_snapshot(li, 0, filp, buf, off, count);
+}
+
+static ssize_t read_statistics_last_bin_cb(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(kobj_to_dev(kobj));
+  return lattest_read_snapshot(li, 1, filp, buf, off, count);
+}
+
+static ssize_t read_windows_bin_cb(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count) {
+  struct lattest_inst *li = dev_get_drvdata(kobj_to_dev(kobj));
+  return lattest_read_snapshot(li, SNAPSHOT_WINDOWS, filp, buf, off, count);
+}
+
+static BIN_ATTR(statistics_bin,      S_IRUSR | S_IRGRP | S_IROTH, read_statistics_bin_cb,      NULL, 0);
+static BIN_ATTR(statistics_last_bin, S_IRUSR | S_IRGRP | S_IROTH, read_statistics_last_bin_cb, NULL, 0);
+static BIN_ATTR(windows_bin,         S_IRUSR | S_IRGRP | S_IROTH, read_windows_bin_cb,         NULL, 0);
+
+//////////////////////////////////////////////////////////////////////////////
+// DebugFS ///////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * /sys/kernel/debug/lattest/LatTest/histogram has all bins of all
+ * histograms, which don't fit into the single page of a sysfs attribute.
+ * The histograms are copied at open(), the seq_file then streams them.
+ */
+
+static struct dentry *lattest_debugfs;     // /sys/kernel/debug/lattest/
+
+// copy of one histogram
+struct lattest_dump_hist {
+  const char *block;                       // name of the statistics block
+  int cpu;                                 // -1 for merged over all CPUs
+  int src;                                 // IPIs only: source CPU, -1 otherwise
+  long long (*bin_low)(const struct lattest_inst *, unsigned int);
+  unsigned int hist_num;
+  u64 *histogram;
+};
+
+// copy of all histograms of an instance, the private data of the seq_file
+struct lattest_dump {
+  struct lattest_inst *li;
+  bool sparse;                             // skip empty bins
+  unsigned int cur_hist;                   // position of the seq_file
+  unsigned int cur_bin;
+  unsigned int num;                        // number of histograms
+  unsigned int max;                        // allocated histograms
+  struct lattest_dump_hist hist[];
+};
+
+/**
+ * Free a dump with the copies of its histograms
+ */
+static void lattest_dump_free(struct lattest_dump *d) {
+  unsigned int i;
+  for (i = 0; i < d->num; i++) {
+    kvfree(d->hist[i].histogram);
+  }
+  kvfree(d);
+}
+
+/**
+ * Append a copy of the histogram of a statistics block to the dump
+ */
+static int lattest_dump_add(struct lattest_dump *d, const char *block, int cpu, const struct lattest_stat *stat, long long (*bin_low)(const struct lattest_inst *, unsigned int)) {
+  struct lattest_dump_hist *h = &d->hist[d->num];
+  if (d->num >= d->max) return -EAGAIN;   // the CPUs changed meanwhile
+  h->histogram = kvmalloc_array(stat->hist_num, sizeof(h->histogram[0]), GFP_KERNEL);
+  if (!h->histogram) return -ENOMEM;
+  memcpy(h->histogram, stat->histogram, stat->hist_num*sizeof(h->histogram[0]));
+  h->block    = block;
+  h->cpu      = cpu;
+  h->src      = -1;
+  h->bin_low  = bin_low;
+  h->hist_num = stat->hist_num;
+  d->num++;
+  return 0;
+}
+
+/**
+ * Append the IPI histograms merged over all pairs and of each pair of CPUs
+ *
+ * Must be called with stat_mutex held.
+ */
+static int lattest_dump_add_ipi(struct lattest_dump *d, struct lattest_inst *li) {
+  struct lattest_stat ipi;
+  struct lattest_stat pair;
+  int cpu;
+  int src;
+  int ret;
+
+  ret = lattest_stat_alloc(&ipi, lattest_latency_bins(li));
+  if (ret < 0) return ret;
+  for_each_lattest_cpu(li, cpu) {
+    for_each_lattest_cpu(li, src) {
+      if (src == cpu) continue;
+      lattest_ipi_stat_get(per_cpu_ptr(li->cpu_data, cpu), src, &pair);
+      lattest_stat_merge(&ipi, &pair);
+    }
+  }
+  ret = lattest_dump_add(d, "ipi", -1, &ipi, lattest_latency_bin_low);
+  lattest_stat_free(&ipi);
+  for_each_lattest_cpu(li, cpu) {
+    for_each_lattest_cpu(li, src) {
+      if (src == cpu || ret < 0) continue;
+      lattest_ipi_stat_get(per_cpu_ptr(li->cpu_data, cpu), src, &pair);
+      ret = lattest_dump_add(d, "ipi", cpu, &pair, lattest_latency_bin_low);
+      if (ret == 0) d->hist[d->num-1].src = src;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Copy the histograms of an instance: jitter, latency, overhead, and thread
+ * and loopback IRQ latency if there were samples, each merged and per CPU
+ *
+ * Like statistics, the bins are read while the timers might update them.
+ */
+static struct lattest_dump *lattest_dump_take(struct lattest_inst *li) {
+  struct lattest_dump *d;
+  struct lattest_stat stat = { .histogram = NULL };
+  struct lattest_stat lat  = { .histogram = NULL };
+  struct lattest_stat thr  = { .histogram = NULL };
+  struct lattest_stat ovh  = { .histogram = NULL };
+  struct lattest_stat irq;
+  struct lattest_stat cpu_stat;
+  struct lattest_stat cpu_lat;
+  struct lattest_stat cpu_thr;
+  struct lattest_stat cpu_ovh;
+  unsigned int max;
+  int cpu;
+  int ret;
+
+  // 4 blocks merged and per CPU, the IRQ, and the IPIs merged and per pair
+  max = 4*(1 + cpumask_weight(&li->run_cpus)) + 1;
+  if (li->ipi) max += 1 + cpumask_weight(&li->run_cpus)*cpumask_weight(&li->run_cpus);
+  d = kvzalloc(struct_size(d, hist, max), GFP_KERNEL);
+  if (!d) return ERR_PTR(-ENOMEM);
+  d->max    = max;
+  d->li     = li;
+  d->sparse = li->dump_sparse;
+
+  mutex_lock(&li->stat_mutex);
+  ret = lattest_stat_alloc(&stat, lattest_jitter_bins(li));
+  if (ret == 0) ret = lattest_stat_alloc(&lat, lattest_latency_bins(li));
+  if (ret == 0) ret = lattest_stat_alloc(&thr, lattest_latency_bins(li));
+  if (ret == 0) ret = lattest_stat_alloc(&ovh, lattest_latency_bins(li));
+  if (ret < 0) goto out;
+  lattest_stat_merge_all(li, 0, &stat, &lat, &thr, &ovh);
+  lattest_irq_stat_get(li, 0, &irq);
+
+  ret = lattest_dump_add(d, "jitter", -1, &stat, lattest_jitter_bin_low);
+  for_each_lattest_cpu(li, cpu) {
+    lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), 0, &cpu_stat, &cpu_lat, &cpu_thr, &cpu_ovh);
+    if (ret == 0) ret = lattest_dump_add(d, "jitter", cpu, &cpu_stat, lattest_jitter_bin_low);
+  }
+  if (ret == 0) ret = lattest_dump_add(d, "latency", -1, &lat, lattest_latency_bin_low);
+  for_each_lattest_cpu(li, cpu) {
+    lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), 0, &cpu_stat, &cpu_lat, &cpu_thr, &cpu_ovh);
+    if (ret == 0) ret = lattest_dump_add(d, "latency", cpu, &cpu_lat, lattest_latency_bin_low);
+  }
+  if (ret == 0) ret = lattest_dump_add(d, "overhead", -1, &ovh, lattest_latency_bin_low);
+  for_each_lattest_cpu(li, cpu) {
+    lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), 0, &cpu_stat, &cpu_lat, &cpu_thr, &cpu_ovh);
+    if (ret == 0) ret = lattest_dump_add(d, "overhead", cpu, &cpu_ovh, lattest_latency_bin_low);
+  }
+  if (thr.num > 0) {
+    if (ret == 0) ret = lattest_dump_add(d, "thread", -1, &thr, lattest_latency_bin_low);
+    for_each_lattest_cpu(li, cpu) {
+      lattest_stat_get(per_cpu_ptr(li->cpu_data, cpu), 0, &cpu_stat, &cpu_lat, &cpu_thr, &cpu_ovh);
+      if (ret == 0) ret = lattest_dump_add(d, "thread", cpu, &cpu_thr, lattest_latency_bin_low);
+    }
+  }
+  // the loopback IRQ isn't per CPU
+  if (irq.num > 0 && ret == 0) ret = lattest_dump_add(d, "irq", -1, &irq, lattest_latency_bin_low);
+  if (li->ipi && ret == 0) ret = lattest_dump_add_ipi(d, li);
+
+out:
+  lattest_stat_free(&ovh);
+  lattest_stat_free(&thr);
+  lattest_stat_free(&lat);
+  lattest_stat_free(&stat);
+  mutex_unlock(&li->stat_mutex);
+  if (ret < 0) {
+    lattest_dump_free(d);
+    return ERR_PTR(ret);
+  }
+  return d;
+}
+
+/**
+ * Find the bin of position pos, counted over all bins of all histograms
+ * after the header line at 0
+ *
+ * With sparse, pos is advanced to the next non-empty bin.
+ */
+static void *lattest_dump_find(struct lattest_dump *d, loff_t *pos) {
+  loff_t bin = *pos - 1;
+  unsigned int i;
+
+  for (i = 0; i < d->num && bin >= d->hist[i].hist_num; i++) {
+    bin -= d->hist[i].hist_num;
+  }
+  for (; i < d->num; i++, bin = 0) {
+    for (; bin < d->hist[i].hist_num; bin++, (*pos)++) {
+      if (d->sparse && d->hist[i].histogram[bin] == 0) continue;
+      d->cur_hist = i;
+      d->cur_bin  = bin;
+      return d;
+    }
+  }
+  return NULL;
+}
+
+static void *lattest_dump_seq_start(struct seq_file *m, loff_t *pos) {
+  if (*pos == 0) return SEQ_START_TOKEN;
+  return lattest_dump_find(m->private, pos);
+}
+
+static void *lattest_dump_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+  (*pos)++;
+  return lattest_dump_find(m->private, pos);
+}
+
+static void lattest_dump_seq_stop(struct seq_file *m, void *v) {
+}
+
+/**
+ * Print one bin as a CSV line, the first line is the header
+ *
+ * The first and the last bin also count the values below and above.
+ */
+static int lattest_dump_seq_show(struct seq_file *m, void *v) {
+  struct lattest_dump *d = m->private;
+  struct lattest_dump_hist *h;
+
+  if (v == SEQ_START_TOKEN) {
+    seq_puts(m, "block,cpu,bin_low_ns,count\n");
+    return 0;
+  }
+  h = &d->hist[d->cur_hist];
+  if (h->src >= 0) {
+    seq_printf(m, "%s,%d>%d,%lld,%llu\n", h->block, h->src, h->cpu, h->bin_low(d->li, d->cur_bin), h->histogram[d->cur_bin]);
+  } else if (h->cpu < 0) {
+    seq_printf(m, "%s,all,%lld,%llu\n", h->block, h->bin_low(d->li, d->cur_bin), h->histogram[d->cur_bin]);
+  } else {
+    seq_printf(m, "%s,%d,%lld,%llu\n", h->block, h->cpu, h->bin_low(d->li, d->cur_bin), h->histogram[d->cur_bin]);
+  }
+  return 0;
+}
+
+static const struct seq_operations lattest_dump_seq_ops = {
+  .start = lattest_dump_seq_start,
+  .next  = lattest_dump_seq_next,
+  .stop  = lattest_dump_seq_stop,
+  .show  = lattest_dump_seq_show,
+};
+
+/**
+ * Copy the histograms of the instance for the seq_file
+ */
+static int lattest_dump_open(struct inode *inode, struct file *filp) {
+  struct lattest_dump *d = lattest_dump_take(inode->i_private);
+  int ret;
+
+  if (IS_ERR(d)) return PTR_ERR(d);
+  ret = seq_open(filp, &lattest_dump_seq_ops);
+  if (ret) {
+    lattest_dump_free(d);
+    return ret;
+  }
+  ((struct seq_file *)filp->private_data)->private = d;
+  return 0;
+}
+
+static int lattest_dump_release(struct inode *inode, struct file *filp) {
+  lattest_dump_free(((struct seq_file *)filp->private_data)->private);
+  return seq_release(inode, filp);
+}
+
+static const struct file_operations lattest_dump_fops = {
+  .owner   = THIS_MODULE,
+  .open    = lattest_dump_open,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = lattest_dump_release,
+};
+
+/**
+ * Create the debugfs directory of an instance, named like its device
+ *
+ * Failures of debugfs are not fatal and need not be checked.
+ */
+static void lattest_inst_debugfs_create(struct lattest_inst *li) {
+  struct dentry *dir = debugfs_create_dir(dev_name(li->dev), lattest_debugfs);
+  debugfs_create_file("histogram", S_IRUSR | S_IRGRP, dir, li, &lattest_dump_fops);
+  debugfs_create_bool("sparse", S_IRUSR | S_IWUSR | S_IRGRP, dir, &li->dump_sparse);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Character Device //////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * /dev/LatTest only supports mmap() of the raw sample ring buffers, see
+ * lattest.h. The minor selects the instance, the page offset the CPU.
+ */
+
+static dev_t       lattest_devt;
+static struct cdev lattest_cdev;
+
+static void lattest_vm_open(struct vm_area_struct *vma) {
+  struct lattest_inst *li = vma->vm_private_data;
+  atomic_inc(&li->ring_mapped);
+}
+
+static void lattest_vm_close(struct vm_area_struct *vma) {
+  struct lattest_inst *li = vma->vm_private_data;
+  atomic_dec(&li->ring_mapped);
+}
+
+static const struct vm_operations_struct lattest_vm_ops = {
+  .open  = lattest_vm_open,
+  .close = lattest_vm_close,
+};
+
+/**
+ * Map the ring buffer of the CPU selected by the offset
+ */
+static int lattest_mmap(struct file *filp, struct vm_area_struct *vma) {
+  unsigned int id = iminor(file_inode(filp));
+  struct lattest_inst *li;
+  unsigned long map_pages;
+  unsigned long cpu;
+  int ret;
+
+  if (id >= lattest_instances) return -ENODEV;
+  li = lattest_insts[id];
+  mutex_lock(&li->ring_mutex);
+  if (li->ring_size == 0) {
+    ret = -ENODEV;   // ring buffers disabled
+    goto out;
+  }
+  map_pages = LATTEST_RING_MAP_SIZE(li->ring_size, PAGE_SIZE) >> PAGE_SHIFT;
+  cpu = vma->vm_pgoff / map_pages;
+  if ((vma->vm_pgoff % map_pages) != 0 || cpu >= nr_cpu_ids || !cpu_possible(cpu)) {
+    ret = -ENXIO;
+    goto out;
+  }
+  if (vma_pages(vma) > map_pages) {
+    ret = -EINVAL;
+    goto out;
+  }
+  ret = remap_vmalloc_range(vma, per_cpu_ptr(li->cpu_data, cpu)->ring, 0);
+  if (ret < 0) goto out;
+  vma->vm_ops = &lattest_vm_ops;
+  vma->vm_private_data = li;
+  lattest_vm_open(vma);
+out:
+  mutex_unlock(&li->ring_mutex);
+  return ret;
+}
+
+static const struct file_operations lattest_fops = {
+  .owner = THIS_MODULE,
+  .mmap  = lattest_mmap,
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Initialization & Finalization /////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Allocate and initialize an instance with the default configuration
+ */
+static struct lattest_inst *lattest_inst_create(int id) {
+  struct lattest_inst *li;
+  int ret;
+  int cpu;
+
+  li = kzalloc(sizeof(*li), GFP_KERNEL);
+  if (!li) return ERR_PTR(-ENOMEM);
+  li->cpu_data = alloc_percpu(struct lattest_cpu);
+  if (!li->cpu_data) {
+    kfree(li);
+    return ERR_PTR(-ENOMEM);
+  }
+  li->id = id;
+  mutex_init(&li->stat_mutex);
+  mutex_init(&li->reset_mutex);
+  mutex_init(&li->snapshot_mutex);
+  mutex_init(&li->ring_mutex);
+  raw_spin_lock_init(&li->outlier_lock);
+  atomic_set(&li->ring_mapped, 0);
+  atomic_set(&li->timers_active, 0);
+  INIT_WORK(&li->event_work, lattest_event_work);
+  INIT_DELAYED_WORK(&li->stream_work, lattest_stream_work);
+
+  // set defaults
+  li->gpio_cpu       = -1;
+  li->period_kt      = ms_to_ktime(10);
+  li->hist_mode      = HIST_MODE_LINEAR;
+  li->hist_bin_num   = 20;
+  li->hist_bin_width = 1000;  // ns
+  li->hist_bin_offset = 0;    // ns
+  cpumask_copy(&li->cpus, cpu_online_mask);
+  li->timer_mode     = HRTIMER_MODE_ABS_PINNED_HARD;
+  li->timer_clock    = CLOCK_MONOTONIC;
+  li->thread_prio    = 0;     // disabled
+  li->idle_qos_us    = -1;    // disabled
+  li->outlier_threshold_ns = 0;   // disabled
+  li->breaktrace     = false;
+  li->window_ns      = 1000LL * NSEC_PER_MSEC;   // 1s
+
+  // timers
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    lc->li = li;
+    lc->runcount = 0;     // 0: stopped
+    seqcount_init(&lc->seq);
+    seqcount_init(&lc->ipi_seq);
+    hrtimer_init(&lc->timer, li->timer_clock, li->timer_mode);
+    lc->timer.function = &lattest_timer_function;
+  }
+  ret = lattest_hist_alloc(li);
+  if (ret == 0) ret = lattest_window_alloc(li);
+  if (ret == 0) ret = lattest_attribution_alloc(li);
+  if (ret) {
+    lattest_attribution_free(li);
+    lattest_window_free(li);
+    lattest_hist_free(li);
+    free_percpu(li->cpu_data);
+    kfree(li);
+    return ERR_PTR(ret);
+  }
+  return li;
+}
+
+/**
+ * Stop the timers and threads of an instance and wait for its last
+ * notification, before its device is removed
+ */
+static void lattest_inst_stop(struct lattest_inst *li) {
+  int ret_cancel;
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    struct lattest_cpu *lc = per_cpu_ptr(li->cpu_data, cpu);
+    ret_cancel = 0;
+    while (hrtimer_callback_running(&lc->timer)) {
+      ret_cancel++;
+    }
+    if (ret_cancel != 0) {
+      printk(KERN_INFO " lattest Waited for hrtimer callback on CPU%d to finish (%d)\n", cpu, ret_cancel);
+    }
+    if (hrtimer_active(&lc->timer) != 0) {
+      ret_cancel = hrtimer_cancel(&lc->timer);
+      printk(KERN_INFO " lattest active hrtimer on CPU%d cancelled: %d (%d)\n", cpu, ret_cancel, lc->runcount);
+    }
+    if (hrtimer_is_queued(&lc->timer) != 0) {
+      ret_cancel = hrtimer_cancel(&lc->timer);
+      printk(KERN_INFO " lattest queued hrtimer on CPU%d cancelled: %d (%d)\n", cpu, ret_cancel, lc->runcount);
+    }
+  }
+  lattest_threads_stop(li);
+  cancel_work_sync(&li->event_work);
+  mutex_lock(&li->stat_mutex);
+  lattest_qos_remove(li);   // also after cancelled infinite runs
+  mutex_unlock(&li->stat_mutex);
+  lattest_stream_stop(li);
+}
+
+/**
+ * Stop an instance and free it
+ *
+ * Its sysfs device must already be removed and no ring may be mapped.
+ */
+static void lattest_inst_destroy(struct lattest_inst *li) {
+  lattest_inst_stop(li);
+  lattest_ring_free(li);
+  lattest_snapshot_free(li);
+  lattest_attribution_free(li);
+  lattest_window_free(li);
+  lattest_ipi_free(li);
+  lattest_hist_free(li);
+  free_percpu(li->cpu_data);
+  kfree(li);
+}
+
+/**
+ * Create the device of an instance with all its sysfs attributes
+ *
+ * The first instance is /sys/class/LatTest/LatTest/ and /dev/LatTest, the
+ * others are numbered. Only the first one has the load attributes.
+ */
+static void lattest_inst_sysfs_create(struct lattest_inst *li) {
+  struct device *dev;
+  int ret;
+
+  if (li->id == 0) {
+    dev = device_create(s_pDeviceClass, NULL, MKDEV(MAJOR(lattest_devt), 0), li, "LatTest");
+  } else {
+    dev = device_create(s_pDeviceClass, NULL, MKDEV(MAJOR(lattest_devt), li->id), li, "LatTest%d", li->id);
+  }
+  BUG_ON(IS_ERR(dev));
+  li->dev = dev;
+  ret = device_create_file(dev, &dev_attr_status);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_event);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_period);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_period_ns);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_control);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_config);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_hist_mode);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_statistics);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_cpus);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_timer_mode);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_clock);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_timestamp);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_thread_prio);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_ipi);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_idle_qos_us);
+  BUG_ON(ret < 0);
+  if (li->id == 0) {
+    ret = device_create_file(dev, &dev_attr_load);
+    BUG_ON(ret < 0);
+    ret = device_create_file(dev, &dev_attr_load_cpus);
+    BUG_ON(ret < 0);
+  }
+  ret = device_create_file(dev, &dev_attr_threshold_ns);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_breaktrace);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_outliers);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_window_ms);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_windows);
+  BUG_ON(ret < 0);
+  ret = device_create_bin_file(dev, &bin_attr_windows_bin);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_stream);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_ringbuffer);
+  BUG_ON(ret < 0);
+  ret = device_create_bin_file(dev, &bin_attr_statistics_bin);
+  BUG_ON(ret < 0);
+  ret = device_create_file(dev, &dev_attr_statistics_last);
+  BUG_ON(ret < 0);
+  ret = device_create_bin_file(dev, &bin_attr_statistics_last_bin);
+  BUG_ON(ret < 0);
+  printk(KERN_INFO "  Registered sysfs attributes at /sys/class/LatTest/%s/\n", dev_name(dev));
+}
+
+/**
+ * Remove the sysfs attributes and the device of an instance
+ */
+static void lattest_inst_sysfs_remove(struct lattest_inst *li) {
+  struct device *dev = li->dev;
+
+  device_remove_file(dev, &dev_attr_status);
+  device_remove_file(dev, &dev_attr_event);
+  device_remove_file(dev, &dev_attr_period);
+  device_remove_file(dev, &dev_attr_period_ns);
+  device_remove_file(dev, &dev_attr_control);
+  device_remove_file(dev, &dev_attr_config);
+  device_remove_file(dev, &dev_attr_hist_mode);
+  device_remove_file(dev, &dev_attr_statistics);
+  device_remove_file(dev, &dev_attr_cpus);
+  device_remove_file(dev, &dev_attr_timer_mode);
+  device_remove_file(dev, &dev_attr_clock);
+  device_remove_file(dev, &dev_attr_timestamp);
+  device_remove_file(dev, &dev_attr_thread_prio);
+  device_remove_file(dev, &dev_attr_ipi);
+  device_remove_file(dev, &dev_attr_idle_qos_us);
+  if (li->id == 0) {
+    device_remove_file(dev, &dev_attr_load);
+    device_remove_file(dev, &dev_attr_load_cpus);
+  }
+  device_remove_file(dev, &dev_attr_threshold_ns);
+  device_remove_file(dev, &dev_attr_breaktrace);
+  device_remove_file(dev, &dev_attr_outliers);
+  device_remove_file(dev, &dev_attr_window_ms);
+  device_remove_file(dev, &dev_attr_windows);
+  device_remove_bin_file(dev, &bin_attr_windows_bin);
+  device_remove_file(dev, &dev_attr_stream);
+  device_remove_file(dev, &dev_attr_ringbuffer);
+  device_remove_bin_file(dev, &bin_attr_statistics_bin);
+  device_remove_file(dev, &dev_attr_statistics_last);
+  device_remove_bin_file(dev, &bin_attr_statistics_last_bin);
+  device_destroy(s_pDeviceClass, MKDEV(MAJOR(lattest_devt), li->id));
+  li->dev = NULL;
+}
+
+/**
+ * Apply a module parameter to an instance via the store callback of the
+ * attribute with the same name
+ *
+ * With commas, they are replaced by blanks first, so lists of values can be
+ * given on the kernel command line without quotes.
+ */
+static int lattest_param_apply(struct lattest_inst *li, const char *name, const char *val, bool commas,
+    ssize_t (*store)(struct device *, struct device_attribute *, const char *, size_t)) {
+  char tmp[64];
+  ssize_t ret;
+
+  if (!val || *val == '\0') return 0;
+  if (strscpy(tmp, val, sizeof(tmp)) < 0) {
+    ret = -EINVAL;
+  } else {
+    if (commas) strreplace(tmp, ',', ' ');
+    ret = store(li->dev, NULL, tmp, strlen(tmp));
+  }
+  if (ret < 0) {
+    printk(KERN_ERR "lattest: Invalid module parameter %s=%s: %zd\n", name, val, ret);
+    return ret;
+  }
+  return 0;
+}
+
+/**
+ * Configure the first instance from the module parameters and start it if
+ * requested
+ *
+ * An invalid parameter doesn't fail the module load, the instance can still
+ * be configured via sysfs then.
+ */
+static void lattest_params_apply(struct lattest_inst *li) {
+  // the same order as a script writing the attributes, the start last
+  if (lattest_param_apply(li, "hist_mode",  param_hist_mode,  false, store_hist_mode_cb))  return;
+  if (lattest_param_apply(li, "config",     param_config,     true,  store_config_cb))     return;
+  if (lattest_param_apply(li, "cpus",       param_cpus,       false, store_cpus_cb))       return;
+  if (lattest_param_apply(li, "period_ns",  param_period_ns,  false, store_period_ns_cb))  return;
+  if (lattest_param_apply(li, "timer_mode", param_timer_mode, true,  store_timer_mode_cb)) return;
+  if (!param_autostart || *param_autostart == '\0') return;
+  if (strcmp(param_autostart, "stop") == 0 || strcmp(param_autostart, "reset") == 0) {
+    printk(KERN_ERR "lattest: Invalid module parameter autostart=%s\n", param_autostart);
+    return;
+  }
+  if (lattest_param_apply(li, "autostart",  param_autostart,  false, store_control_cb))    return;
+  printk(KERN_INFO "  Started %s at load time\n", dev_name(li->dev));
+}
+
+static int __init lattest_init(void) {
+
+  int ret;
+  int id;
+
+  printk(KERN_INFO "Initializing LatTest: Small kernel module to test the latency variance\n");
+
+  if (lattest_instances < 1 || lattest_instances > LATTEST_INSTANCES_MAX) {
+    printk(KERN_ERR "Number of instances must be 1..%d\n", LATTEST_INSTANCES_MAX);
+    return -EINVAL;
+  }
+
+  // GPIO
+  if (gpio_lattest >= 0) {
+    ret = gpio_request_one(gpio_lattest, GPIOF_OUT_INIT_LOW, "lattest");
+    if (ret) {
+      printk(KERN_ERR "Unable to request GPIOs: %d\n", ret);
+      return ret;
+    }
+    gpio_lattest_value = 1;   // start with 0, ISR will set it to 1 at first call
+    if (gpio_direct) {
+      ret = lattest_gpio_map();
+      if (ret) {
+        printk(KERN_ERR "Unable to map GPIO registers: %d\n", ret);
+        gpio_free(gpio_lattest);
+        return ret;
+      }
+      printk(KERN_INFO "  Toggling GPIO %d by direct register access\n", gpio_lattest);
+    }
+  }
+
+  // set defaults
+  load_type      = LOAD_NONE;
+  cpumask_clear(&load_cpus);
+
+  // idle states and frequencies for the samples, before the first timer
+  lattest_idle_probes_register();
+
+  // instances with their timers and histograms
+  for (id = 0; id < lattest_instances; id++) {
+    lattest_insts[id] = lattest_inst_create(id);
+    if (IS_ERR(lattest_insts[id])) {
+      ret = PTR_ERR(lattest_insts[id]);
+      lattest_insts[id] = NULL;
+      printk(KERN_ERR "Unable to allocate instance %d: %d\n", id, ret);
+      goto err_inst;
+    }
+  }
+
+  // GPIO loopback, the handler needs the histograms of the first instance
+  seqcount_init(&irq_seq);
+  if (gpio_lattest_irq >= 0) {
+    if (gpio_lattest < 0) {
+      printk(KERN_ERR "GPIO loopback needs the toggled GPIO\n");
+      ret = -EINVAL;
+    } else {
+      ret = lattest_gpio_irq_request(lattest_insts[0]);
+    }
+    if (ret) {
+      printk(KERN_ERR "Unable to request the loopback GPIO IRQ: %d\n", ret);
+      goto err_inst;
+    }
+    printk(KERN_INFO "  GPIO loopback from GPIO %d to GPIO %d, IRQ %d\n", gpio_lattest, gpio_lattest_irq, lattest_irq);
+  }
+
+  // generic netlink family for streaming the windows
+  ret = genl_register_family(&lattest_genl_family);
+  if (ret) {
+    printk(KERN_ERR "Unable to register generic netlink family: %d\n", ret);
+    goto err_irq;
+  }
+
+  // character device for mmap() of the ring buffers, one minor per instance
+  ret = alloc_chrdev_region(&lattest_devt, 0, LATTEST_INSTANCES_MAX, "lattest");
+  if (ret) {
+    printk(KERN_ERR "Unable to allocate character device: %d\n", ret);
+    goto err_genl;
+  }
+  cdev_init(&lattest_cdev, &lattest_fops);
+  lattest_cdev.owner = THIS_MODULE;
+  ret = cdev_add(&lattest_cdev, lattest_devt, LATTEST_INSTANCES_MAX);
+  BUG_ON(ret < 0);
+
+  // SysFS
+  s_pDeviceClass = class_create(THIS_MODULE, "LatTest");
+  BUG_ON(IS_ERR(s_pDeviceClass));
+  for (id = 0; id < lattest_instances; id++) {
+    lattest_inst_sysfs_create(lattest_insts[id]);
+  }
+
+  // DebugFS
+  lattest_debugfs = debugfs_create_dir("lattest", NULL);
+  for (id = 0; id < lattest_instances; id++) {
+    lattest_inst_debugfs_create(lattest_insts[id]);
+  }
+
+  // configuration and start by module parameters, e.g., to measure during boot
+  lattest_params_apply(lattest_insts[0]);
+
+  // A non 0 return means init_module failed; module can't be loaded. 
+  return 0;
+
+err_genl:
+  genl_unregister_family(&lattest_genl_family);
+err_irq:
+  lattest_gpio_irq_free(lattest_insts[0]);
+err_inst:
+  for (id = 0; id < lattest_instances; id++) {
+    if (lattest_insts[id]) lattest_inst_destroy(lattest_insts[id]);
+    lattest_insts[id] = NULL;
+  }
+  lattest_idle_probes_unregister();
+  if (gpio_regs) iounmap(gpio_regs);
+  if (gpio_lattest >= 0) gpio_free(gpio_lattest);
+  return ret;
+}
+
+static void __exit lattest_exit(void) {
+  int id;
+
+  debugfs_remove_recursive(lattest_debugfs);
+  for (id = 0; id < lattest_instances; id++) {
+    lattest_inst_stop(lattest_insts[id]);
+    lattest_inst_sysfs_remove(lattest_insts[id]);
+  }
+  class_destroy(s_pDeviceClass);
+  cdev_del(&lattest_cdev);
+  unregister_chrdev_region(lattest_devt, LATTEST_INSTANCES_MAX);
+  genl_unregister_family(&lattest_genl_family);   // the stream workers are stopped
+  lattest_idle_probes_unregister();                // the timers are stopped
+
+  lattest_load_stop();
+
+  // GPIO
+  lattest_gpio_irq_free(lattest_insts[0]);
+  if (gpio_lattest >= 0) {
+    lattest_gpio_set(0);
+    if (gpio_regs) iounmap(gpio_regs);
+    gpio_regs = NULL;
+    gpio_free(gpio_lattest);
+  }
+
+  // no mappings can be left, the module is pinned by the open file
+  for (id = lattest_instances-1; id >= 0; id--) {
+    lattest_inst_destroy(lattest_insts[id]);
+    lattest_insts[id] = NULL;
+  }
 
   printk(KERN_INFO "Exit lattest\n");
 }
@@ -0,0 +1,179 @@
+/**
+ * Data structures shared between the LatTest kernel module and userspace
+ *
+ * Raw sample ring buffer
+ * ----------------------
+ * Each CPU has its own single-producer/single-consumer ring buffer, which is
+ * mapped to userspace via mmap() of /dev/LatTest (/dev/LatTest1, ... for the
+ * further instances, the same for all paths below). The mapping of CPU n starts
+ * at the offset n*LATTEST_RING_MAP_SIZE(size, pagesize) and begins with a
+ * struct lattest_ring_header, the samples follow at data_offset.
+ *
+ * The kernel only writes head, userspace only writes tail. Both are free
+ * running counters, the slot of a counter value is (counter & (size-1)).
+ * Userspace reads samples from tail to head and then advances tail. If the
+ * ring is full, new samples are dropped and counted in dropped. The mapping
+ * is writable for tail, the kernel keeps its own copies of all other header
+ * fields and never reads them back.
+ *
+ * Binary statistics snapshot
+ * --------------------------
+ * Reading /sys/class/LatTest/LatTest/statistics_bin returns a struct
+ * lattest_snapshot, merged over all CPUs, followed by the raw histograms as
+ * arrays of __u64. Their position is given by hist_offset in bytes from the
+ * start of the snapshot. The snapshot is taken when reading at offset 0
+ * and belongs to the open file, concurrent readers each get their own. A
+ * read fails with ESTALE if too many other readers took snapshots
+ * meanwhile.
+ * statistics_last_bin has the same layout for the interval before the last
+ * "reset" written to control.
+ *
+ * Rolling window summaries
+ * ------------------------
+ * Reading /sys/class/LatTest/LatTest/windows_bin returns a struct
+ * lattest_windows followed by num struct lattest_window: the summaries of
+ * the last finished windows of each CPU, oldest first. Windows without any
+ * sample are skipped. The snapshot is taken when reading at offset 0, also
+ * per open file.
+ *
+ * Streaming of window summaries
+ * -----------------------------
+ * While 1 is written to /sys/class/LatTest/LatTest/stream, the module
+ * multicasts the finished windows of all instances in the group
+ * LATTEST_GENL_MCGRP of the generic netlink family LATTEST_GENL_NAME. Each
+ * LATTEST_CMD_WINDOWS message has the attributes LATTEST_NLA_INSTANCE,
+ * LATTEST_NLA_WINDOW_NS, LATTEST_NLA_REALTIME_OFFSET, any number of
+ * LATTEST_NLA_WINDOW with one struct lattest_window each, and LATTEST_NLA_LOST.
+ * A worker sends them about once per window, the timers only fill the
+ * window rings as usual. Windows which were already overwritten in the
+ * ring of their CPU when the worker comes by are counted as lost.
+ *
+ * Author: Johann Glaser
+ */
+
+#ifndef LATTEST_H
+#define LATTEST_H
+
+#include <linux/types.h>
+
+#define LATTEST_RING_VERSION 2
+
+// idle_state of a sample which isn't a cpuidle state index
+#define LATTEST_IDLE_BUSY    (-1)   // the CPU wasn't idle
+#define LATTEST_IDLE_UNKNOWN (-2)   // idle, but the state isn't known
+
+// one raw sample, written by the hrtimer callback
+struct lattest_sample {
+  __u64 timestamp_ns;   // time of the timer callback
+  __s64 latency_ns;     // wakeup latency against the programmed expiry
+  __u32 cpu;            // CPU the timer ran on
+  __u32 overrun;        // number of expiries skipped before this callback
+  __s32 idle_state;     // cpuidle state the CPU woke up from or LATTEST_IDLE_*, since version 2
+  __u32 freq_khz;       // frequency of the CPU, 0 if unknown, since version 2
+};
+
+// head of each per-CPU ring mapping, head and tail live in separate cachelines
+struct lattest_ring_header {
+  __u32 version;        // LATTEST_RING_VERSION
+  __u32 size;           // number of sample slots, a power of 2
+  __u32 data_offset;    // offset of the first sample from the header
+  __u32 reserved;
+  __u32 head;           // number of samples written (kernel)
+  __u32 dropped;        // number of samples dropped because the ring was full (kernel)
+  __u8  pad0[40];
+  __u32 tail;           // number of samples consumed (userspace)
+  __u8  pad1[60];
+};
+
+// size of the mapping of a single CPU's ring with 'size' slots
+#define LATTEST_RING_MAP_SIZE(size, pagesize) \
+  ((pagesize) + ((((size)*sizeof(struct lattest_sample))+(pagesize)-1) & ~((pagesize)-1)))
+
+#define LATTEST_SNAPSHOT_VERSION 6
+
+// percentiles of each statistics block in parts per million: p50, p99, p99.9, p99.99
+#define LATTEST_PERCENTILE_NUM 4
+#define LATTEST_PERCENTILES_PPM { 500000, 990000, 999000, 999900 }
+
+// histogram modes, see hist_mode
+#define LATTEST_HIST_LINEAR 0
+#define LATTEST_HIST_LOG    1
+
+// statistics of one measured quantity
+struct lattest_snapshot_stat {
+  __s64 min;            // ns
+  __s64 max;            // ns
+  __s64 num;            // number of samples
+  __s64 sum;            // ns
+  __u64 sumsq_hi;       // ns², upper 64 bit of the 128 bit sum of squares
+  __u64 sumsq_lo;       // ns², lower 64 bit
+  __u32 hist_num;       // number of histogram bins
+  __u32 hist_offset;    // offset of the __u64 histogram[hist_num] from the start of the snapshot
+  __s64 percentile[LATTEST_PERCENTILE_NUM];  // ns, upper bound of the bin, see LATTEST_PERCENTILES_PPM, since version 5
+};
+
+struct lattest_snapshot {
+  __u32 version;        // LATTEST_SNAPSHOT_VERSION
+  __u32 size;           // size of the snapshot including the histograms in bytes
+  __u32 hist_mode;      // LATTEST_HIST_*
+  __u32 reserved;
+  __s64 hist_bin_width;   // ns, linear histograms only
+  __s64 hist_bin_offset;  // ns, linear histograms only
+  __s64 period_ns;
+  struct lattest_snapshot_stat jitter;
+  struct lattest_snapshot_stat latency;
+  struct lattest_snapshot_stat thread;  // wakeup latency of the SCHED_FIFO thread, since version 2
+  struct lattest_snapshot_stat irq;     // GPIO loopback IRQ latency, since version 3
+  __s64 overruns;       // total number of missed expiries, since version 4
+  __s64 overrun_max;    // most expiries missed in a row
+  __s64 overrun_max_ns; // time of the callback after overrun_max
+  struct lattest_snapshot_stat overhead;  // execution time of the timer callback, since version 6
+};
+
+#define LATTEST_WINDOWS_VERSION 1
+
+// summary of the callback latency of one CPU during one window
+struct lattest_window {
+  __s64 start_ns;       // start of the window on the timer's clock, a multiple of window_ns
+  __s64 num;            // number of samples
+  __s64 min;            // ns
+  __s64 max;            // ns
+  __s64 sum;            // ns
+  __s64 overruns;       // number of missed expiries
+  __u32 cpu;
+  __u32 reserved;
+};
+
+struct lattest_windows {
+  __u32 version;        // LATTEST_WINDOWS_VERSION
+  __u32 size;           // size of the snapshot including the windows in bytes
+  __u32 num;            // number of windows
+  __u32 reserved;
+  __s64 window_ns;      // length of a window
+  __s64 realtime_offset_ns;  // CLOCK_REALTIME minus the timer's clock when the snapshot was taken
+};
+
+#define LATTEST_GENL_NAME    "lattest"
+#define LATTEST_GENL_VERSION 1
+#define LATTEST_GENL_MCGRP   "windows"
+
+// generic netlink commands
+enum {
+  LATTEST_CMD_UNSPEC,
+  LATTEST_CMD_WINDOWS,        // kernel to userspace: finished windows of an instance
+};
+
+// generic netlink attributes
+enum {
+  LATTEST_NLA_UNSPEC,
+  LATTEST_NLA_PAD,
+  LATTEST_NLA_INSTANCE,       // __u32: 0 for LatTest, n for LatTest<n>
+  LATTEST_NLA_WINDOW_NS,      // __s64: length of a window
+  LATTEST_NLA_REALTIME_OFFSET,  // __s64: CLOCK_REALTIME minus the timer's clock when the message was built
+  LATTEST_NLA_WINDOW,         // struct lattest_window, repeated
+  LATTEST_NLA_LOST,           // __u32: windows overwritten before they were sent, since streaming was enabled
+  __LATTEST_NLA_MAX,
+};
+#define LATTEST_NLA_MAX (__LATTEST_NLA_MAX - 1)
+
+#endif // LATTEST_H
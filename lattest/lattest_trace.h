@@ -0,0 +1,110 @@
+/**
+ * Tracepoints of the LatTest kernel module
+ *
+ * The events are in the "lattest" trace system, e.g., for
+ *   perf record -e lattest:lattest_sample -a
+ *   trace-cmd record -e lattest
+ * or eBPF programs attached to them. Disabled tracepoints cost a patched out
+ * branch in the timer callback, enabled ones are written to the per-CPU
+ * buffers of the tracer. Their cost is part of the overhead statistics.
+ *
+ * Author: Johann Glaser
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lattest
+
+#if !defined(LATTEST_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define LATTEST_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/cpumask.h>
+
+// one sample of the timer callback, like the raw sample ring buffer, idle
+// is the cpuidle state the CPU woke up from or LATTEST_IDLE_*
+TRACE_EVENT(lattest_sample,
+  TP_PROTO(int inst, long long now_ns, long long latency_ns, long long jitter_ns, int overrun, int idle, unsigned int freq_khz),
+  TP_ARGS(inst, now_ns, latency_ns, jitter_ns, overrun, idle, freq_khz),
+  TP_STRUCT__entry(
+    __field(int,          inst)
+    __field(long long,    now_ns)
+    __field(long long,    latency_ns)
+    __field(long long,    jitter_ns)
+    __field(int,          overrun)
+    __field(int,          idle)
+    __field(unsigned int, freq_khz)
+  ),
+  TP_fast_assign(
+    __entry->inst       = inst;
+    __entry->now_ns     = now_ns;
+    __entry->latency_ns = latency_ns;
+    __entry->jitter_ns  = jitter_ns;
+    __entry->overrun    = overrun;
+    __entry->idle       = idle;
+    __entry->freq_khz   = freq_khz;
+  ),
+  TP_printk("inst=%d now=%lld latency=%lld jitter=%lld overrun=%d idle=%d freq=%ukHz",
+    __entry->inst, __entry->now_ns, __entry->latency_ns, __entry->jitter_ns, __entry->overrun,
+    __entry->idle, __entry->freq_khz)
+);
+
+// expiries missed before a callback
+TRACE_EVENT(lattest_overrun,
+  TP_PROTO(int inst, long long now_ns, int missed),
+  TP_ARGS(inst, now_ns, missed),
+  TP_STRUCT__entry(
+    __field(int,       inst)
+    __field(long long, now_ns)
+    __field(int,       missed)
+  ),
+  TP_fast_assign(
+    __entry->inst   = inst;
+    __entry->now_ns = now_ns;
+    __entry->missed = missed;
+  ),
+  TP_printk("inst=%d now=%lld missed=%d", __entry->inst, __entry->now_ns, __entry->missed)
+);
+
+// start of a run, runcount -1 is infinite
+TRACE_EVENT(lattest_start,
+  TP_PROTO(int inst, int runcount, long long period_ns, const struct cpumask *cpus),
+  TP_ARGS(inst, runcount, period_ns, cpus),
+  TP_STRUCT__entry(
+    __field(int,       inst)
+    __field(int,       runcount)
+    __field(long long, period_ns)
+    __bitmask(cpus,    nr_cpumask_bits)
+  ),
+  TP_fast_assign(
+    __entry->inst      = inst;
+    __entry->runcount  = runcount;
+    __entry->period_ns = period_ns;
+    __assign_bitmask(cpus, cpumask_bits(cpus), nr_cpumask_bits);
+  ),
+  TP_printk("inst=%d runcount=%d period=%lld cpus=%s",
+    __entry->inst, __entry->runcount, __entry->period_ns, __get_bitmask(cpus))
+);
+
+// end of a run: finished by the last timer, or stopped via control
+TRACE_EVENT(lattest_stop,
+  TP_PROTO(int inst, bool finished),
+  TP_ARGS(inst, finished),
+  TP_STRUCT__entry(
+    __field(int,  inst)
+    __field(bool, finished)
+  ),
+  TP_fast_assign(
+    __entry->inst     = inst;
+    __entry->finished = finished;
+  ),
+  TP_printk("inst=%d %s", __entry->inst, __entry->finished ? "finished" : "stopped")
+);
+
+#endif // LATTEST_TRACE_H
+
+// this header is not in include/trace/events/
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lattest_trace
+#include <trace/define_trace.h>